@@ -1,387 +1,585 @@
-#include <ctype.h>
+#define _GNU_SOURCE
+
+#include <fcntl.h>
+#include <stdarg.h>
 #include <stdbool.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <string.h>
 #include <stdlib.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "elf_image.h"
+#include "incremental.h"
+#include "input.h"
+#include "libarmcopro.h"
+#include "mcr_encoding.h"
+#include "output.h"
+#include "parallel.h"
+#include "peephole.h"
+#include "scan.h"
+#include "server.h"
+#include "stats.h"
+#include "summary.h"
 
 #define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
 #define BIT(x) (1 << (x))
 
-enum {
-	B0001 = 1,
-	B0111 = 7,
-	B1110 = 14,
-	B1111 = 15,
-};
-
 /******************************************************************************
- * Accessors to manipulate bitfields
+ * Decoding
  *****************************************************************************/
 
-/* It would be nice to use functions to explicitely specify types,
- * but it is impossible to use functions to initialize static constants
- */
-
-#define Pack(_Field, val) ((val & (Mask_ ##_Field)) << (ShiftWidth_ ##_Field))
-#define Extract(_Field, opcode) ((opcode >> (ShiftWidth_ ##_Field)) & (Mask_ ##_Field))
-
-#define MaskInReg(_Field) ((Mask_ ##_Field) << (ShiftWidth_ ##_Field))
+/* The ISA revisions selected with --isa */
+static uint32_t IsaMask = ARMCOPRO_ISA_ALL;
 
 /******************************************************************************
- * MCR/MRC definitions
+ * Annotation cache
  *****************************************************************************/
 
 /*
- * MCR/MRC format:
- * 31   27   23   19   15
- * YYYY 1110 YYYL YYYY RRRR 1111 YYY1 YYYY
- * COND YYYY OP1L CR_N R__D 1111 OP21 CR_M
+ * Code keeps using the same few encodings, so the rendered annotations
+ * are kept in a direct-mapped cache indexed by a hash of the opcode, and
+ * a repeated instruction costs a probe and a copy. Each thread has a
+ * cache of its own, small enough to stay in L2. The caches are chained
+ * together to sum up their counters at exit.
+ *
+ * Input without repetition only pays for the probes and the copies, so a
+ * thread that hits less than one time in ANNOTATION_CACHE_MIN_HIT_RATIO
+ * over a window of probes leaves the cache alone for a while.
  */
 enum {
-	MaskMcrMrc_24_28 = B1110,
-	MaskMcrMrc_8_11 = B1111,
-	MaskMcrMrc = (MaskMcrMrc_24_28 << 24) | (MaskMcrMrc_8_11 << 8),
-
-	ShiftWidth_Op1 = 21,
-	ShiftWidth_Ldop = 20,
-	ShiftWidth_CRn = 16,
-	ShiftWidth_Rd = 12,
-	ShiftWidth_Cp = 8,
-	ShiftWidth_Op2 = 5,
-	ShiftWidth_CRm = 0,
-
-	Mask_1bit = B0001,
-	Mask_3bits = B0111,
-	Mask_4bits = B1111,
-
-	Mask_Op1 = Mask_3bits,
-	Mask_Ldop = Mask_1bit,
-	Mask_CRn = Mask_4bits,
-	Mask_Rd = Mask_4bits,
-	Mask_Cp = Mask_4bits,
-	Mask_Op2 = Mask_3bits,
-	Mask_CRm = Mask_4bits,
-
-	Mask_Op1_CRm_Op2_CRn = MaskInReg(Op1) | MaskInReg(CRm) | MaskInReg(Op2) | MaskInReg(CRn),
+	ANNOTATION_CACHE_BITS = 10,
+	ANNOTATION_CACHE_SIZE = 1 << ANNOTATION_CACHE_BITS,
+	/* Fills up the entry to 256 bytes; longer annotations are not cached */
+	ANNOTATION_CACHE_TEXT = 246,
+	ANNOTATION_CACHE_WINDOW = 4096,
+	ANNOTATION_CACHE_MIN_HIT_RATIO = 8,
+	ANNOTATION_CACHE_BACKOFF = 16 * ANNOTATION_CACHE_WINDOW,
 };
 
-static bool is_mcr_or_mrc(uint32_t opcode)
+struct AnnotationCacheEntry {
+	uint32_t opcode;
+	/* The ISA selection the text is for, 0 if the entry is empty */
+	uint32_t isa;
+	uint16_t length;
+	char text[ANNOTATION_CACHE_TEXT];
+};
+
+struct AnnotationCache {
+	struct AnnotationCacheEntry entries[ANNOTATION_CACHE_SIZE];
+	uint64_t hits;
+	uint64_t misses;
+	uint64_t bypassed;
+	/* Probes and hits in the current window */
+	uint32_t windowProbes;
+	uint32_t windowHits;
+	/* Instructions left to decode without the cache */
+	uint32_t backoff;
+	struct AnnotationCache *next;
+};
+
+static bool AnnotationCacheEnabled = true;
+static struct AnnotationCache *AnnotationCaches;
+static __thread struct AnnotationCache *ThreadAnnotationCache;
+
+static struct AnnotationCache *AnnotationCacheGet(void)
 {
-	return MaskMcrMrc == (opcode & MaskMcrMrc);
+	struct AnnotationCache *cache = ThreadAnnotationCache;
+
+	if (cache || !AnnotationCacheEnabled) {
+		return cache;
+	}
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		return NULL;
+	}
+	cache->next = __atomic_load_n(&AnnotationCaches, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&AnnotationCaches, &cache->next, cache,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+	return ThreadAnnotationCache = cache;
 }
 
-/******************************************************************************
- * Coprocessor Register Descriptions
- *****************************************************************************/
+static inline uint32_t AnnotationCacheSlot(uint32_t opcode)
+{
+	return (opcode * 0x9e3779b1u) >> (32 - ANNOTATION_CACHE_BITS);
+}
 
-enum ArmIsaRevision {
-	ArmIsaCortexA9 = BIT(0),
-	ArmIsaCortexA15 = BIT(1),
-	ArmIsaCortexR4 = BIT(2),
-};
+static struct AnnotationCacheEntry *AnnotationCacheProbe(struct AnnotationCache *cache,
+		uint32_t opcode)
+{
+	if (cache->backoff) {
+		cache->backoff--;
+		cache->bypassed++;
+		return NULL;
+	}
 
-#define RDESC_ALL(_mask, _name, _comment) \
-	{ .mask = _mask, .name = _name, .comment = _comment, .isaMask = 0xffffffff }
+	struct AnnotationCacheEntry *entry = &cache->entries[AnnotationCacheSlot(opcode)];
+	bool hit = (entry->opcode == opcode) && (entry->isa == IsaMask);
 
-#define RDESC_A15(_mask, _name, _comment) \
-	{ .mask = _mask, .name = _name, .comment = _comment, .isaMask = ArmIsaCortexA15 }
+	cache->hits += hit;
+	cache->misses += !hit;
+	cache->windowHits += hit;
+	if (++cache->windowProbes == ANNOTATION_CACHE_WINDOW) {
+		if (cache->windowHits * ANNOTATION_CACHE_MIN_HIT_RATIO < ANNOTATION_CACHE_WINDOW) {
+			cache->backoff = ANNOTATION_CACHE_BACKOFF;
+		}
+		cache->windowProbes = 0;
+		cache->windowHits = 0;
+	}
+	return entry;
+}
 
-#define RDESC_CR4(_mask, _name, _comment) \
-	{ .mask = _mask, .name = _name, .comment = _comment, .isaMask = ArmIsaCortexR4 }
+static void PrintAnnotationCacheStats(void)
+{
+	uint64_t hits = 0;
+	uint64_t misses = 0;
+	uint64_t bypassed = 0;
+
+	for (struct AnnotationCache *cache = __atomic_load_n(&AnnotationCaches, __ATOMIC_ACQUIRE);
+			cache; cache = cache->next) {
+		hits += cache->hits;
+		misses += cache->misses;
+		bypassed += cache->bypassed;
+	}
+	fprintf(stderr, "annotation cache: %llu hits, %llu misses (%.1f%% hits), %llu bypassed\n",
+			(unsigned long long)hits, (unsigned long long)misses,
+			(hits + misses) ? (100.0 * hits / (hits + misses)) : 0.0,
+			(unsigned long long)bypassed);
+}
 
-#define STRING_UNWRAP(str) ((NULL == str) ? "Unknown" : str)
+#ifdef WITH_STATS
+static enum StatsFormat RunStatsFormat;
 
-static struct RegDesc {
-	uint32_t mask;
-	char *name;
-	char *comment;
-	uint32_t isaMask;
-} RegDescs[] = {
-	/**
-	 * C0
-	 */
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "MIDR", "Main ID Register"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "CTR", "Cache Type Register"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 2), "TCMTR", "TCM Type Register"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 3), "TLBTR", "TLB Type Register"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 5), "MPIDR", "Multiprocessor Affinity Register"),
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 6), "REVIDR", "Revision ID Register"),
-
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "ID_PFR0", "Processor Feature Register 0"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 1), "ID_PFR1", "Processor Feature Register 1"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 2), "ID_DFR0", "Debug Feature Register 0"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 3), "ID_AFR0", "Auiliary Feature Register 0"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 4), "ID_MMFR0", "Memory Model Feature Register 0"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 5), "ID_MMFR1", "Memory Model Feature Register 1"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 6), "ID_MMFR2", "Memory Model Feature Register 2"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 7), "ID_MMFR3", "Memory Model Feature Register 3"),
-
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 0), "ID_ISAR0", "Instruction Set Attributes Register 0"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 1), "ID_ISAR1", "Instruction Set Attributes Register 1"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 2), "ID_ISAR2", "Instruction Set Attributes Register 2"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 3), "ID_ISAR3", "Instruction Set Attributes Register 3"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 4), "ID_ISAR4", "Instruction Set Attributes Register 4"),
-	RDESC_ALL(Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 5), "ID_ISAR5", "Instruction Set Attributes Register 5"),
-
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 1) | Pack(CRm, 2) | Pack(Op2, 0), "CCSIDR", "Current Cache Size ID"),
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 1) | Pack(CRm, 2) | Pack(Op2, 1), "CLIDR", "Current Cache Level ID"),
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 1) | Pack(CRm, 2) | Pack(Op2, 7), "AIDR", NULL),
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 2) | Pack(CRm, 0) | Pack(Op2, 0), "CSSELR", "Cache Size Selection"),
-
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 0), "VPIDR", NULL),
-	RDESC_A15(Pack(CRn, 0) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 5), "VMPIDR", NULL),
-
-	/**
-	 * C1
-	 */
-	RDESC_ALL(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "SCTLR", "System Control Register"),
-	RDESC_ALL(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "ACTLR", "Auxiliary Control Register"),
-	RDESC_ALL(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 2), "CPACR", "Coprocessor Access Control Register"),
-
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "SCR", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 1), "SDER", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 2), "NSACR", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 3), "VCR", NULL),
-
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 0), "HSCTLR", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 1), "HACTLR", NULL),
-
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 0), "HCR", "Hypervisor Control Register"),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 1), "HDCR", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 2), "HCPTR", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 3), "HSTR", NULL),
-	RDESC_A15(Pack(CRn, 1) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 7), "HACR", "Hypervisor AUX Control Register"),
-
-	/**
-	 * C2
-	 */
-	RDESC_A15(Pack(CRn, 2) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "TTBR0", "Translation Table Base Register 0"),
-	RDESC_A15(Pack(CRn, 2) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "TTBR1", "Translation Table Base Register 1"),
-	RDESC_A15(Pack(CRn, 2) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 2), "TTBCR", "Translation Table Base Control Register"),
+static void PrintRunStats(void)
+{
+	StatsPrint(stderr, RunStatsFormat, IsaMask);
+}
+#endif
 
-	RDESC_A15(Pack(CRn, 2) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 2), "HTCR", NULL),
-	RDESC_A15(Pack(CRn, 2) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 2), "VTCR", NULL),
+static void DecodeMrcAndPrint(struct Output *out, uint32_t opcode)
+{
+	struct ArmCoproInsn insn;
 
-	/**
-	 * C3
-	 */
-	RDESC_A15(Pack(CRn, 3) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "DACR", NULL),
+	/* Most lines are something else, skip the call for them */
+	if (!IsCoproAccess(opcode)) {
+		return;
+	}
 
-	/**
-	 * C5
-	 */
-	RDESC_ALL(Pack(CRn, 5) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "DFSR", "Data Fault Status Register"),
-	RDESC_ALL(Pack(CRn, 5) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "IFSR", "Instruction Fault Status Register"),
+	uint64_t start = StatsStart();
+	StatsAccess(opcode);
+
+	struct AnnotationCache *cache = AnnotationCacheGet();
+	struct AnnotationCacheEntry *entry = NULL;
+	if (cache) {
+		entry = AnnotationCacheProbe(cache, opcode);
+		StatsAdd(StatCacheProbes, !!entry);
+		if (entry && (entry->opcode == opcode) && (entry->isa == IsaMask)) {
+			StatsAdd(StatCacheHits, 1);
+			OutputCopy(out, entry->text, entry->length);
+			StatsStop(PhaseDecode, start);
+			return;
+		}
+	}
 
-	RDESC_A15(Pack(CRn, 5) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "ADFSR", "Auxiliary Data Fault Status Register"),
-	RDESC_A15(Pack(CRn, 5) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 1), "AIFSR", "Auxiliary Instruction Fault Status Register"),
+	StatsAdd(StatDecodes, 1);
+	ArmCoproDecode(opcode, IsaMask, &insn);
+	char *p = OutputReserve(out, ARMCOPRO_FORMAT_MAX);
+	char *end = ArmCoproFormat(p, &insn);
+	if (entry && (end - p <= ANNOTATION_CACHE_TEXT)) {
+		entry->opcode = opcode;
+		entry->isa = IsaMask;
+		entry->length = end - p;
+		memcpy(entry->text, p, end - p);
+	}
+	OutputCommit(out, end);
+	StatsStop(PhaseDecode, start);
+}
 
-	RDESC_A15(Pack(CRn, 5) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 0), "HADFSR", "Hypervisor Auxiliary Data Fault Status Register"),
-	RDESC_A15(Pack(CRn, 5) | Pack(Op1, 4) | Pack(CRm, 1) | Pack(Op2, 0), "HAIFSR", "Hypervisor Auxiliary Instruction Fault Status Register"),
-	RDESC_A15(Pack(CRn, 5) | Pack(Op1, 4) | Pack(CRm, 2) | Pack(Op2, 0), "HSR", NULL),
+/*
+ * In peephole mode the objdump and ELF decoders follow the values of
+ * the core registers, and an MCR writing a known value to a register
+ * with bitfields in the database gets its fields decoded as well.
+ */
+static bool PeepholeEnabled;
 
-	/**
-	 * C6
-	 */
-	RDESC_ALL(Pack(CRn, 6) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "DFAR", "Data Fault Address Register"),
-	RDESC_ALL(Pack(CRn, 6) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 2), "IFAR", "Instruction Fault Address Register"),
+/*
+ * A listing streams by in address order, so an MCR of a register loaded
+ * from a literal pool after the code has its fields printed when the
+ * pool word comes by, after that line. The MCR is given up on when the
+ * listing passes the address of the word, or at the next label.
+ */
+enum {
+	DEFERRED_VALUES_MAX = 16,
+};
 
-	RDESC_A15(Pack(CRn, 6) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 0), "HDFAR", "Hypervisor Data Fault Address Register"),
-	RDESC_A15(Pack(CRn, 6) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 2), "HIFAR", "Hypervisor Instruction Fault Address Register"),
-	RDESC_A15(Pack(CRn, 6) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 4), "HPFAR", NULL),
+struct DeferredValue {
+	uint32_t opcode;
+	uint32_t literal;
+};
 
-	RDESC_CR4(Pack(CRn, 6) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "MPU BAR", "MPU Base Address Register"),
-	RDESC_CR4(Pack(CRn, 6) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 2), "MPU RSE", "MPU Region Size and Enable"),
-	RDESC_CR4(Pack(CRn, 6) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 4), "MPU RAC", "MPU Region Access Control"),
+struct DeferredValues {
+	struct DeferredValue values[DEFERRED_VALUES_MAX];
+	size_t count;
+};
 
-	RDESC_CR4(Pack(CRn, 6) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 0), "MPU RN", "MPU Memory Region Number"),
+static void PrintValueFields(struct Output *out, const struct ArmCoproInsn *insn,
+		uint32_t value)
+{
+	for (size_t i = 0; i < insn->numRegs; i++) {
+		char *p = OutputReserve(out, ARMCOPRO_FORMAT_MAX);
+		OutputCommit(out, ArmCoproFormatValue(p, &insn->regs[i], value, IsaMask));
+	}
+}
 
-	/**
-	 * C7
-	 */
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "Reserved", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "Reserved", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 2), "Reserved", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 3), "Reserved", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 4), "NOP", NULL),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "ICIALLUIS", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 6), "BPIALLIS", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 7), "Reserved", NULL),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 4) | Pack(Op2, 0), "PAR", NULL),
-
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 0), "ICIALLU", "Invalidate Instruction Cache"),
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 1), "ICIMVAU", "Invalidate Instruction Cache by MVA"),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 2), "Reserved", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 3), "Reserved", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 4), "ISB", "Instruction Sync Barrier"),
-	RDESC_CR4(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 4), "FlushPrefetch", "Flush Prefetch Buffer"),
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 6), "BPIALL", "Invalidate Entire Branch Predictor Array"),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 6) | Pack(Op2, 6), "DCIMVAC", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 6) | Pack(Op2, 2), "DCISW", "Invalidate Data Cache by Set/Way"),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 0), "ATS1CPR", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 1), "ATS1CPW", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 2), "ATS1CUR", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 3), "ATS1CUW", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 4), "ATS1NSOPR", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 5), "ATS1NSOPW", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 6), "ATS1NSOUR", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 8) | Pack(Op2, 7), "ATS1NSOUW", NULL),
-
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 10) | Pack(Op2, 1), "DCCVAC", "Clean Data Cache line by Virtual Address"),
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 10) | Pack(Op2, 2), "DCCSW", "Clean Data Cache by Set/Way"),
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 10) | Pack(Op2, 4), "DSB", "Data Sync Barrier"),
-	RDESC_ALL(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 10) | Pack(Op2, 5), "DMB", "Data Memory Barrier"),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 11) | Pack(Op2, 1), "DCCVAU", "Clean Data cache by VA to PoU"),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 14) | Pack(Op2, 1), "DCCIMVAC", "Clean Data cache by MVA to PoU"),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 0) | Pack(CRm, 14) | Pack(Op2, 2), "DCCISW", NULL),
-
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 4) | Pack(CRm, 8) | Pack(Op2, 0), "ATS1HR", NULL),
-	RDESC_A15(Pack(CRn, 7) | Pack(Op1, 4) | Pack(CRm, 8) | Pack(Op2, 0), "ATS1HW", NULL),
-
-	/**
-	 * C8
-	 */
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 3) | Pack(Op2, 0), "TLBIALLIS", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 3) | Pack(Op2, 1), "TLBIMVAIS", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 3) | Pack(Op2, 2), "TLBIASIDIS", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 3) | Pack(Op2, 3), "TLBIMVAAIS", NULL),
-
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 0), "TLBIALL", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 1), "TLBIMVA", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 2), "TLBIASID", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 5) | Pack(Op2, 3), "TLBIMVAA", NULL),
-
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 6) | Pack(Op2, 0), "TLBIALL", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 6) | Pack(Op2, 1), "TLBIMVA", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 6) | Pack(Op2, 2), "TLBIASID", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 6) | Pack(Op2, 3), "TLBIMVAA", NULL),
-
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 7) | Pack(Op2, 0), "TLBIALL", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 7) | Pack(Op2, 1), "TLBIMVA", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 7) | Pack(Op2, 2), "TLBIASID", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 0) | Pack(CRm, 7) | Pack(Op2, 3), "TLBIMVAA", NULL),
-
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 4) | Pack(CRm, 3) | Pack(Op2, 0), "TLBIALLHIS", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 4) | Pack(CRm, 3) | Pack(Op2, 1), "TLBIMVAHIS", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 4) | Pack(CRm, 3) | Pack(Op2, 4), "TLBIALLNSHIS", NULL),
-
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 4) | Pack(CRm, 7) | Pack(Op2, 0), "TLBIALLH", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 4) | Pack(CRm, 7) | Pack(Op2, 1), "TLBIMVAH", NULL),
-	RDESC_A15(Pack(CRn, 8) | Pack(Op1, 4) | Pack(CRm, 7) | Pack(Op2, 4), "TLBIALLNSNH", NULL),
-
-	/**
-	 * C9
-	 */
-	RDESC_A15(Pack(CRn, 9) | Pack(Op1, 1) | Pack(CRm, 0) | Pack(Op2, 2), "L2CTLR", NULL),
-	RDESC_A15(Pack(CRn, 9) | Pack(Op1, 1) | Pack(CRm, 0) | Pack(Op2, 3), "L2ECTLR", NULL),
+/**
+ * Print the fields of the value an MCR writes, if it is known. With
+ * deferred, one loaded from a literal that is still to come is kept
+ * there for ResolveDeferredValues.
+ */
+static void PrintWrittenValue(struct Output *out, const struct Peephole *ph,
+		struct DeferredValues *deferred, uint32_t opcode)
+{
+	struct ArmCoproInsn insn;
+	uint32_t value;
+	uint32_t literal;
 
-	/**
-	 * C10
-	 */
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "TLB Lockdown", NULL),
+	/* The 64-bit registers have no fields in the database */
+	if (!is_mcr_or_mrc(opcode)) {
+		return;
+	}
+	uint64_t start = StatsStart();
+	StatsAdd(StatDecodes, 1);
+	ArmCoproDecode(opcode, IsaMask, &insn);
+	if (insn.mrc || !insn.numRegs) {
+		/* Nothing to print */
+	}
+	else if (PeepholeValue(ph, insn.rd, &value)) {
+		PrintValueFields(out, &insn, value);
+	}
+	else if (deferred && (deferred->count < DEFERRED_VALUES_MAX)
+			&& PeepholePendingLiteral(ph, insn.rd, &literal)) {
+		deferred->values[deferred->count++] = (struct DeferredValue){ opcode, literal };
+	}
+	StatsStop(PhaseDecode, start);
+}
 
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 0), "PRRR/MAIR0", NULL),
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 0) | Pack(CRm, 2) | Pack(Op2, 1), "NMRR/MAIR1", NULL),
+/**
+ * Print the fields for the MCRs waiting on the ARM word at addr, if it is
+ * a data word, and give up on those whose literal it is past.
+ */
+static void ResolveDeferredValues(struct Output *out, struct DeferredValues *deferred,
+		uint32_t addr, uint32_t word, bool data)
+{
+	size_t kept = 0;
+
+	for (size_t i = 0; i < deferred->count; i++) {
+		const struct DeferredValue *value = &deferred->values[i];
+		if (data && (value->literal == addr)) {
+			struct ArmCoproInsn insn;
+			ArmCoproDecode(value->opcode, IsaMask, &insn);
+			PrintValueFields(out, &insn, word);
+		}
+		else if (value->literal > addr) {
+			deferred->values[kept++] = *value;
+		}
+	}
+	deferred->count = kept;
+}
 
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 0) | Pack(CRm, 3) | Pack(Op2, 0), "AMAIR0", NULL),
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 0) | Pack(CRm, 3) | Pack(Op2, 1), "AMAIR1", NULL),
+/******************************************************************************
+ * ARM MRC/MCR decoding: testing routines
+ ****************************************************************************/
 
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 4) | Pack(CRm, 2) | Pack(Op2, 0), "HMAIR0", NULL),
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 4) | Pack(CRm, 2) | Pack(Op2, 1), "HMAIR1", NULL),
+/*
+ * The full test runs the decoder over all 2^32 encodings, split into
+ * blocks that the threads take in turn, and checks it against a plain
+ * reimplementation: a linear scan over the database and the original
+ * printf formats. Nothing is printed unless a check fails.
+ */
+enum {
+	FULLTEST_BLOCK_BITS = 24,
+	FULLTEST_BLOCKS = 1 << (32 - FULLTEST_BLOCK_BITS),
+	/* Failures reported in detail, the rest are only counted */
+	FULLTEST_MAX_REPORTS = 16,
+};
 
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 4) | Pack(CRm, 3) | Pack(Op2, 0), "HAMAIR0", NULL),
-	RDESC_A15(Pack(CRn, 10) | Pack(Op1, 4) | Pack(CRm, 3) | Pack(Op2, 1), "HAMAIR1", NULL),
+struct FullTestStats {
+	uint64_t opcodes;
+	uint64_t hits;
+	uint64_t known;
+	uint64_t failures;
+	double seconds;
+};
 
-	/**
-	 * C12
-	 */
-	RDESC_A15(Pack(CRn, 12) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "VBAR", NULL),
-	RDESC_A15(Pack(CRn, 12) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "MVBAR", NULL),
+struct FullTest {
+	uint32_t nextBlock;
+	uint32_t reports;
+	struct FullTestStats *threads;
+	/* The database, for the reference */
+	struct ArmCoproReg *regs;
+	size_t numRegs;
+};
 
-	RDESC_A15(Pack(CRn, 12) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "ISR", NULL),
-	RDESC_A15(Pack(CRn, 12) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 1), "VIR", NULL),
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
 
-	RDESC_A15(Pack(CRn, 12) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 0), "HVBAR", NULL),
+static void FullTestFail(struct FullTest *test, struct FullTestStats *stats,
+		uint32_t opcode, const char *what)
+{
+	stats->failures++;
+	if (__atomic_fetch_add(&test->reports, 1, __ATOMIC_RELAXED) < FULLTEST_MAX_REPORTS) {
+		fprintf(stderr, "%08x: %s\n", opcode, what);
+	}
+}
 
-	/**
-	 * C13
-	 */
-	RDESC_A15(Pack(CRn, 13) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "FCSEIDR", "[deprecated] FSCE ID Register"),
-	RDESC_A15(Pack(CRn, 13) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 1), "CONTEXTIDR", "Context ID Register"),
-	RDESC_A15(Pack(CRn, 13) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 2), "TPIDRURW", "Software Thread ID Register"),
-	RDESC_A15(Pack(CRn, 13) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 3), "TPIDRURO", NULL),
-	RDESC_A15(Pack(CRn, 13) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 4), "TPIDRPRW", NULL),
+/**
+ * An MCR/MRC or MCRR/MRRC to CP10, CP11, CP14 or CP15, spelt out field
+ * by field.
+ */
+static inline bool IsAccessReference(uint32_t opcode)
+{
+	uint32_t cp = Extract(Cp, opcode);
+	bool decoded = (cp == 10) || (cp == 11) || (cp == 14) || (cp == 15);
+	bool narrow = (((opcode >> 24) & 0xF) == 0xE) && (opcode & BIT(4));
+	bool wide = ((opcode >> 21) & 0x7F) == 0x62;
 
-	RDESC_A15(Pack(CRn, 13) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 2), "HTPIDR", NULL),
+	return decoded && (narrow || wide);
+}
 
-	/**
-	 * C15
-	 */
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0), "PCR", "Power Control Register"),
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 0) | Pack(CRm, 1) | Pack(Op2, 0), "NEONBR", "NEON Busy Register"),
+static inline bool IsWideReference(uint32_t opcode)
+{
+	return !(opcode & BIT(25));
+}
 
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 4) | Pack(CRm, 0) | Pack(Op2, 0), "CFGBA", "Configuration Base Address"),
+static inline bool RegMatches(const struct ArmCoproReg *reg, uint32_t opcode)
+{
+	if ((reg->cp != Extract(Cp, opcode)) || (reg->wide != IsWideReference(opcode))) {
+		return false;
+	}
+	if (reg->wide) {
+		return (reg->op1 == Extract(Op1Wide, opcode)) && (reg->crm == Extract(CRm, opcode));
+	}
+	return (reg->crn == Extract(CRn, opcode)) && (reg->op1 == Extract(Op1, opcode))
+		&& (reg->crm == Extract(CRm, opcode)) && (reg->op2 == Extract(Op2, opcode));
+}
 
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 5) | Pack(CRm, 4) | Pack(Op2, 2), "PCR", "Select Lockdown TLB Entry for read"),
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 5) | Pack(CRm, 4) | Pack(Op2, 4), "PCR", "Select Lockdown TLB Entry for write"),
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 5) | Pack(CRm, 5) | Pack(Op2, 2), "PCR", "Main TLB VA register"),
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 5) | Pack(CRm, 6) | Pack(Op2, 2), "PCR", "Main TLB PA register"),
-	RDESC_A15(Pack(CRn, 15) | Pack(Op1, 5) | Pack(CRm, 7) | Pack(Op2, 2), "PCR", "Main TLB Attribute register"),
+/**
+ * The opcode accessing reg, with condition 0 and core registers r0/r0.
+ */
+static uint32_t RegOpcode(const struct ArmCoproReg *reg)
+{
+	if (reg->wide) {
+		return ValueCoproWide | Pack(Cp, reg->cp) | Pack(Op1Wide, reg->op1)
+			| Pack(CRm, reg->crm);
+	}
+	return ValueCoproReg | Pack(Cp, reg->cp) | Pack(CRn, reg->crn) | Pack(Op1, reg->op1)
+		| Pack(CRm, reg->crm) | Pack(Op2, reg->op2);
+}
 
-	RDESC_CR4(Pack(CRn, 15) | Pack(Op1, 0) | Pack(CRm, 14) | Pack(Op2, 0), "CacheSizeOverride", "Cache Size Override"),
-};
+/**
+ * The annotation of an access as the original decoder printed it, and in
+ * the same manner for MCRR/MRRC.
+ */
+static int FormatMrcReference(const struct FullTest *test, char *buf, size_t size, uint32_t opcode)
+{
+	int n;
+
+	if (IsWideReference(opcode)) {
+		const char *mnemonic = Extract(Ldop, opcode) ? "MRRC" : "MCRR";
+		n = snprintf(buf, size, "%s, %d, %d, r%d, r%d, cr%d\n"
+				"%s, Op1=%d CRm=%d Rd=%d Rd2=%d CP=%d\n",
+				mnemonic, (int)Extract(Cp, opcode), (int)Extract(Op1Wide, opcode),
+				(int)Extract(Rd, opcode), (int)Extract(Rd2, opcode),
+				(int)Extract(CRm, opcode),
+				mnemonic, (int)Extract(Op1Wide, opcode), (int)Extract(CRm, opcode),
+				(int)Extract(Rd, opcode), (int)Extract(Rd2, opcode),
+				(int)Extract(Cp, opcode));
+	}
+	else {
+		const char *mnemonic = Extract(Ldop, opcode) ? "MRC" : "MCR";
+		n = snprintf(buf, size, "%s, %d, %d, r%d, cr%d, cr%d, {%d}\n"
+				"%s, CRn=%d Op1=%d CRm=%d Op2=%d Rd=%d CP=%d\n",
+				mnemonic, (int)Extract(Cp, opcode), (int)Extract(Op1, opcode),
+				(int)Extract(Rd, opcode), (int)Extract(CRn, opcode),
+				(int)Extract(CRm, opcode), (int)Extract(Op2, opcode),
+				mnemonic, (int)Extract(CRn, opcode), (int)Extract(Op1, opcode),
+				(int)Extract(CRm, opcode), (int)Extract(Op2, opcode),
+				(int)Extract(Rd, opcode), (int)Extract(Cp, opcode));
+	}
+
+	for (size_t i = 0; (i < test->numRegs) && (n >= 0) && ((size_t)n < size); i++) {
+		const struct ArmCoproReg *reg = &test->regs[i];
+		if (RegMatches(reg, opcode) && (reg->isa & IsaMask)) {
+			n += snprintf(buf + n, size - n, "[%s] : %s\n",
+					reg->name ? reg->name : "Unknown",
+					reg->comment ? reg->comment : "Unknown");
+		}
+	}
+	return n;
+}
 
-static void DecodeMrcAndPrint(uint32_t opcode)
+static void FullTestOpcode(struct FullTest *test, struct FullTestStats *stats, uint32_t opcode)
 {
-	if (!is_mcr_or_mrc(opcode)) {
+	struct ArmCoproInsn insn;
+	char fast[ARMCOPRO_FORMAT_MAX];
+	char reference[2 * ARMCOPRO_FORMAT_MAX];
+
+	stats->hits++;
+
+	ArmCoproDecode(opcode, IsaMask, &insn);
+	bool wide = IsWideReference(opcode);
+	if (!insn.valid || (insn.opcode != opcode) || (insn.mrc != Extract(Ldop, opcode))
+			|| (insn.wide != wide) || (insn.cp != Extract(Cp, opcode))
+			|| (insn.rd != Extract(Rd, opcode)) || (insn.crm != Extract(CRm, opcode))
+			|| (insn.crn != (wide ? 0 : Extract(CRn, opcode)))
+			|| (insn.op1 != (wide ? Extract(Op1Wide, opcode) : Extract(Op1, opcode)))
+			|| (insn.op2 != (wide ? 0 : Extract(Op2, opcode)))
+			|| (insn.rd2 != (wide ? Extract(Rd2, opcode) : 0))) {
+		FullTestFail(test, stats, opcode, "fields decoded wrong");
 		return;
 	}
 
-	printf("%s, %d, %d, r%d, cr%d, cr%d, {%d}\n",
-			Extract(Ldop, opcode) ? "MRC" : "MCR",
-			Extract(Cp, opcode),
-			Extract(Op1, opcode),
-			Extract(Rd, opcode),
-			Extract(CRn, opcode),
-			Extract(CRm, opcode),
-			Extract(Op2, opcode));
+	size_t length = ArmCoproFormat(fast, &insn) - fast;
+	if (length > ARMCOPRO_FORMAT_MAX) {
+		FullTestFail(test, stats, opcode, "annotation overflows its buffer");
+		return;
+	}
+	int refLength = FormatMrcReference(test, reference, sizeof(reference), opcode);
+	if ((refLength < 0) || (length != (size_t)refLength) || memcmp(fast, reference, length)) {
+		FullTestFail(test, stats, opcode, "annotation differs from the reference");
+	}
 
-	printf("%s, CRn=%d Op1=%d CRm=%d Op2=%d Rd=%d CP=%d\n",
-			Extract(Ldop, opcode) ? "MRC" : "MCR",
-			Extract(CRn, opcode),
-			Extract(Op1, opcode),
-			Extract(CRm, opcode),
-			Extract(Op2, opcode),
-			Extract(Rd, opcode),
-			Extract(Cp, opcode));
+	if (!insn.numRegs) {
+		return;
+	}
+	stats->known++;
+	uint32_t isa = 0;
+	for (size_t i = 0; i < insn.numRegs; i++) {
+		if (!RegMatches(&insn.regs[i], opcode)) {
+			FullTestFail(test, stats, opcode, "register found for another encoding");
+		}
+		isa |= insn.regs[i].isa;
+	}
+	if (insn.isa != isa) {
+		FullTestFail(test, stats, opcode, "wrong ISA mask");
+	}
+}
 
-	uint32_t opcodeMatchMask = opcode & Mask_Op1_CRm_Op2_CRn;
-	for (size_t i = 0; i < ARRAY_SIZE(RegDescs); i++)
-	{
-		if (opcodeMatchMask == RegDescs[i].mask) {
-			printf("[%s] : %s\n",
-					STRING_UNWRAP(RegDescs[i].name),
-					STRING_UNWRAP(RegDescs[i].comment));
+static void FullTestThread(unsigned index, void *arg)
+{
+	struct FullTest *test = arg;
+	struct FullTestStats *stats = &test->threads[index];
+	double start = Now();
+	uint32_t block;
+
+	while ((block = __atomic_fetch_add(&test->nextBlock, 1, __ATOMIC_RELAXED)) < FULLTEST_BLOCKS) {
+		uint32_t first = block << FULLTEST_BLOCK_BITS;
+		uint32_t last = first + ((1u << FULLTEST_BLOCK_BITS) - 1);
+
+		for (uint32_t opcode = first; ; opcode++) {
+			bool expected = IsAccessReference(opcode);
+			if (IsCoproAccess(opcode) != expected) {
+				FullTestFail(test, stats, opcode, "misclassified as a coprocessor access");
+			}
+			if (expected) {
+				FullTestOpcode(test, stats, opcode);
+			}
+			if (opcode == last) {
+				break;
+			}
 		}
+		stats->opcodes += 1u << FULLTEST_BLOCK_BITS;
 	}
+	stats->seconds = Now() - start;
 }
 
-/*
- * decode Rd
- * while Rd is not trashed -> decode
- *
+/**
+ * Sanity checks of the database: no two registers share an encoding on
+ * the same ISA revision, and every register is found by its encoding.
  */
+static uint64_t FullTestDatabase(const struct FullTest *test)
+{
+	uint64_t failures = 0;
+
+	for (size_t i = 0; i < test->numRegs; i++) {
+		const struct ArmCoproReg *reg = &test->regs[i];
+		const char *name = reg->name ? reg->name : "Unknown";
+		uint32_t opcode = RegOpcode(reg);
+		struct ArmCoproInsn insn;
+		bool found = false;
+
+		ArmCoproDecode(opcode, reg->isa, &insn);
+		for (size_t j = 0; j < insn.numRegs; j++) {
+			found = found || (insn.regs[j].name == reg->name);
+		}
+		if (!found) {
+			fprintf(stderr, "%s: not found by its encoding\n", name);
+			failures++;
+		}
+		for (size_t j = i + 1; j < test->numRegs; j++) {
+			if (RegMatches(&test->regs[j], opcode) && (reg->isa & test->regs[j].isa)) {
+				fprintf(stderr, "%s: duplicate key for the same ISA revision as %s\n",
+						name, test->regs[j].name ? test->regs[j].name : "Unknown");
+				failures++;
+			}
+		}
+	}
+	return failures;
+}
 
-/******************************************************************************
- * ARM MRC/MCR decoding: testing routines
- ****************************************************************************/
+static bool RunFullTest(unsigned threads)
+{
+	struct FullTest test;
+	struct FullTestStats total;
+
+	memset(&test, 0, sizeof(test));
+	memset(&total, 0, sizeof(total));
+	test.threads = calloc(threads, sizeof(test.threads[0]));
+	test.numRegs = ArmCoproRegCount();
+	test.regs = calloc(test.numRegs, sizeof(test.regs[0]));
+	if (!test.threads || !test.regs) {
+		perror("fulltest");
+		free(test.threads);
+		free(test.regs);
+		return false;
+	}
+	for (size_t i = 0; i < test.numRegs; i++) {
+		ArmCoproRegGet(i, &test.regs[i]);
+	}
+
+	uint64_t dbFailures = FullTestDatabase(&test);
+	double start = Now();
+	RunThreads(threads, FullTestThread, &test);
+	double seconds = Now() - start;
+
+	for (unsigned i = 0; i < threads; i++) {
+		const struct FullTestStats *stats = &test.threads[i];
+		printf("thread %u: %llu opcodes, %llu accesses, %llu known, %.1f s, %.1f Mop/s\n",
+				i, (unsigned long long)stats->opcodes, (unsigned long long)stats->hits,
+				(unsigned long long)stats->known, stats->seconds,
+				stats->seconds ? (stats->opcodes / stats->seconds * 1e-6) : 0.0);
+		total.opcodes += stats->opcodes;
+		total.hits += stats->hits;
+		total.known += stats->known;
+		total.failures += stats->failures;
+	}
+	total.failures += dbFailures;
+	printf("total: %llu opcodes, %llu accesses, %llu known, %.1f s, %.1f Mop/s, %llu failures\n",
+			(unsigned long long)total.opcodes, (unsigned long long)total.hits,
+			(unsigned long long)total.known, seconds,
+			seconds ? (total.opcodes / seconds * 1e-6) : 0.0,
+			(unsigned long long)total.failures);
+
+	free(test.threads);
+	free(test.regs);
+	return !total.failures;
+}
 
 /******************************************************************************
  * ARM MRC/MCR decoding:
@@ -391,10 +589,10 @@ static void DecodeMrcAndPrint(uint32_t opcode)
  * Decode some hard-coded values. This is just a placeholder for development.
  */
 
-static inline void DemoSomeMcrs(void)
+static inline void DemoSomeMcrs(struct Output *out)
 {
 	static uint32_t test_mcrs[] = {
-		Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0) | Pack(Rd, 5) | Pack(Cp, 15) | MaskMcrMrc,
+		Pack(CRn, 0) | Pack(Op1, 0) | Pack(CRm, 0) | Pack(Op2, 0) | Pack(Rd, 5) | Pack(Cp, 15) | ValueMcrMrc,
 		0xee011f10,
 		0xee061f12,
 		0xee062f11,
@@ -433,89 +631,1948 @@ static inline void DemoSomeMcrs(void)
 		0xee000e15,
 	};
 	for (size_t i = 0; i < ARRAY_SIZE(test_mcrs); i++) {
-		printf("Decoding: %08x\n", test_mcrs[i]);
-		DecodeMrcAndPrint(test_mcrs[i]);
+		char *p = OutputReserve(out, sizeof("Decoding: 01234567\n"));
+		p = FormatString(p, "Decoding: ");
+		p = FormatHex32(p, test_mcrs[i]);
+		p = FormatString(p, "\n");
+		OutputCommit(out, p);
+
+		DecodeMrcAndPrint(out, test_mcrs[i]);
 	}
 }
 
-static inline void RunFullTest(void)
+static void OpenInputOrDie(struct InputStream *in, const char *path)
 {
-	for (uint32_t i = 0; i <= 0xffffffff; i++) {
-		DecodeMrcAndPrint(i);
+	bool ok = path ? InputOpenPath(in, path) : InputOpen(in, STDIN_FILENO);
+	if (!ok) {
+		perror(path ? path : "stdin");
+		exit(1);
 	}
 }
 
-static inline void RunStdinDecoder(void)
+static void FlushOutput(void *out)
 {
-	while (1) {
-		enum {
-			BUF_SIZE = 64,
-		};
-		char buf[BUF_SIZE];
-		memset(buf, 0, BUF_SIZE);
-		uint32_t val = 0;
+	OutputFlush(out);
+}
+
+/*
+ * Line decoders process a whole input stream. The same function serves
+ * the serial path and the chunks of the parallel one.
+ */
+struct LineDecoder {
+	void (*decode)(struct Output *out, struct InputStream *in);
+};
+
+static void DecodeLineChunk(struct Output *out, const char *start, const char *end, void *arg)
+{
+	const struct LineDecoder *decoder = arg;
+	struct InputStream in;
+	struct StatsLoop loop;
+
+	StatsLoopStart(&loop);
+	InputOpenMemory(&in, start, end - start);
+	decoder->decode(out, &in);
+	InputClose(&in);
+	StatsLoopStop(&loop);
+}
+
+/**
+ * Run the decoder over the input file (or stdin). Inputs that are mapped
+ * into memory are split into chunks for the given number of threads.
+ */
+static void RunLineDecoder(struct Output *out, const char *path, unsigned threads,
+		const struct LineDecoder *decoder)
+{
+	struct InputStream in;
 
-		if (!fgets(buf, BUF_SIZE, stdin)) {
-			break;
+	OpenInputOrDie(&in, path);
+
+	if ((threads > 1) && in.mapped) {
+		OutputFlush(out);
+		if (RunChunked(in.data + in.pos, in.size - in.pos, threads, ChunkBoundaryLine,
+					DecodeLineChunk, (void *)decoder, out->fd)) {
+			InputClose(&in);
+			return;
 		}
-		val = strtol(buf, NULL, 16);
-		DecodeMrcAndPrint(val);
-	};
+	}
+
+	/* Echoed lines reference the read buffer until they are written */
+	struct StatsLoop loop;
+	StatsLoopStart(&loop);
+	InputSetFillHook(&in, FlushOutput, out);
+	decoder->decode(out, &in);
+	OutputFlush(out);
+	StatsLoopStop(&loop);
+	InputClose(&in);
 }
 
-static inline void RunObjdumpDecoder(void)
+static void DecodeHexLines(struct Output *out, struct InputStream *in)
 {
-	while (1) {
-		enum {
-			BUF_SIZE = 64,
-		};
-		char buf[BUF_SIZE];
-		memset(buf, 0, BUF_SIZE);
-		uint32_t val = 0;
+	struct InputLine line;
+	uint64_t lines = 0;
+	uint64_t bytes = 0;
+
+	while (InputReadLine(in, &line)) {
+		lines++;
+		bytes += line.length;
+		DecodeMrcAndPrint(out, ParseHexScalar(line.start, line.start + line.length));
+		/* Answer interactive queries right away */
+		if (!in->mapped && (in->pos == in->size)) {
+			OutputFlush(out);
+		}
+	}
+	StatsAdd(StatLines, lines);
+	StatsAdd(StatBytes, bytes);
+}
+
+static inline void RunStdinDecoder(struct Output *out, const char *path, unsigned threads)
+{
+	static const struct LineDecoder decoder = { DecodeHexLines };
+	RunLineDecoder(out, path, threads, &decoder);
+}
+
+/**
+ * GNU objdump output usually has the following format:
+ * OFFSET: OPCODE
+ * where OFFSET is an arbitrary-sized hex integer and the colon is
+ * followed by an arbitrary number of whitespace
+ */
+static inline bool ParseObjdumpLine(const struct InputLine *line, uint32_t *opcode)
+{
+	const char *p = line->start;
+	const char *end = line->start + line->length;
+
+	if (!line->colon) {
+		return false;
+	}
+	while ((p < line->colon) && ((*p == ' ') || (*p == '\t'))) {
+		p++;
+	}
+	if (p == line->colon) {
+		return false;
+	}
+	for (; p < line->colon; p++) {
+		if (!IsHexDigit(*p)) {
+			return false;
+		}
+	}
+
+	p = line->colon + 1;
+	while ((p < end) && ((*p == ' ') || (*p == '\t'))) {
+		p++;
+	}
 
-		if (!fgets(buf, BUF_SIZE, stdin)) {
-			break;
+	/* The common case: a 32-bit ARM opcode */
+	if ((end - p >= 8) && ((end - p == 8) || !IsHexDigit(p[8]))) {
+		if (ParseHex8(p, opcode)) {
+			return true;
 		}
+	}
+
+	/* Thumb halfwords and the like */
+	size_t digits = 0;
+	while ((p + digits < end) && IsHexDigit(p[digits])) {
+		digits++;
+	}
+	if (!digits || (digits > 8)) {
+		return false;
+	}
+	*opcode = ParseHexScalar(p, p + digits);
+	return true;
+}
+
+static void AnnotateObjdumpLines(struct Output *out, struct InputStream *in)
+{
+	struct InputLine line;
+	uint64_t lines = 0;
+	uint64_t bytes = 0;
+
+	while (InputReadLine(in, &line)) {
+		uint32_t val = 0;
+
+		lines++;
+		bytes += line.length;
 
 		/* Echo objdump output to screen */
-		printf("%s", buf);
-		buf[BUF_SIZE - 1] = 0;
-
-		/**
-		 * GNU objdump output usually has the following format:
-		 * OFFSET: OPCODE
-		 * where OFFSET is an arbitrary-sized 32-bit hex integer and
-		 * the colon is followed by an arbitrary number of whitespace
-		 */
-
-		char *opcodeStr = buf;
-		for (size_t i = 0; (i < 9) && (i < BUF_SIZE); i++) {
-			if (isxdigit(buf[i]) || isspace(buf[i])) {
-				opcodeStr++;
+		OutputSpan(out, line.start, line.length);
+
+		if (ParseObjdumpLine(&line, &val)) {
+			DecodeMrcAndPrint(out, val);
+		}
+	}
+	StatsAdd(StatLines, lines);
+	StatsAdd(StatBytes, bytes);
+}
+
+/**
+ * Objdump right-aligns the addresses in eight columns, so they are
+ * usually parsed all at once with the padding taken as zeroes.
+ */
+static inline uint32_t ParseObjdumpAddress(const char *start, const char *colon)
+{
+	uint64_t x;
+	char digits[8];
+	uint32_t addr;
+
+	if (colon - start >= 8) {
+		memcpy(&x, colon - 8, sizeof(x));
+		if (!(x & SWAR_BYTES(SWAR_HIGH))) {
+			x += (SwarInRange(x, ' ', ' ') >> 7) * ('0' - ' ');
+			memcpy(digits, &x, sizeof(digits));
+			if (ParseHex8(digits, &addr)) {
+				return addr;
 			}
 		}
-		if (*opcodeStr != ':') {
+	}
+	return ParseHexScalar(start, colon);
+}
+
+/**
+ * For a line that ParseObjdumpLine accepted, tell whether it holds an ARM
+ * word, either an instruction or a ".word" of data. Thumb halfwords are
+ * not followed.
+ */
+static bool IsObjdumpWord(const struct InputLine *line, bool *data)
+{
+	const char *end = line->start + line->length;
+	const char *p = line->colon + 1;
+	uint32_t word;
+
+	while ((p < end) && ((*p == ' ') || (*p == '\t'))) {
+		p++;
+	}
+	if ((end - p < 8) || ((end - p > 8) && IsHexDigit(p[8])) || !ParseHex8(p, &word)) {
+		return false;
+	}
+
+	p += 8;
+	while ((p < end) && ((*p == ' ') || (*p == '\t'))) {
+		p++;
+	}
+	*data = (end - p >= 5) && !memcmp(p, ".word", 5);
+	return true;
+}
+
+/**
+ * As IsObjdumpWord, and get the address too.
+ */
+static inline bool ParseObjdumpWord(const struct InputLine *line, uint32_t *addr, bool *data)
+{
+	if (!IsObjdumpWord(line, data)) {
+		return false;
+	}
+	*addr = ParseObjdumpAddress(line->start, line->colon);
+	return true;
+}
+
+static void TrackObjdumpLines(struct Output *out, struct InputStream *in)
+{
+	struct InputLine line;
+	struct Peephole ph;
+	struct DeferredValues deferred = { .count = 0 };
+	uint64_t lines = 0;
+	uint64_t bytes = 0;
+
+	PeepholeInit(&ph, NULL, NULL);
+	while (InputReadLine(in, &line)) {
+		uint32_t val = 0;
+		uint32_t addr = 0;
+		bool data = false;
+
+		lines++;
+		bytes += line.length;
+		OutputSpan(out, line.start, line.length);
+
+		if (!ParseObjdumpLine(&line, &val)) {
+			/* Function labels start from scratch */
+			if (line.colon) {
+				PeepholeReset(&ph);
+				deferred.count = 0;
+			}
 			continue;
 		}
-		opcodeStr++;
+		DecodeMrcAndPrint(out, val);
 
-		val = strtol(opcodeStr, NULL, 16);
-		DecodeMrcAndPrint(val);
-	};
+		if (!ParseObjdumpWord(&line, &addr, &data)) {
+			/* Thumb code is not followed */
+			PeepholeReset(&ph);
+			continue;
+		}
+		if (deferred.count) {
+			ResolveDeferredValues(out, &deferred, addr, val, data);
+		}
+		if (data) {
+			PeepholeData(&ph, addr, val);
+		}
+		else {
+			PrintWrittenValue(out, &ph, &deferred, val);
+			PeepholeStep(&ph, addr, val);
+		}
+	}
+	StatsAdd(StatLines, lines);
+	StatsAdd(StatBytes, bytes);
 }
 
-int main(int argc, char **argv) {
-	if ((2 == argc) && (!strcmp(argv[1], "fulltest"))) {
-		RunFullTest();
-		exit(0);
+/**
+ * The register values are followed through the whole listing, so it is
+ * decoded serially in peephole mode.
+ */
+static inline void RunObjdumpDecoder(struct Output *out, const char *path, unsigned threads)
+{
+	static const struct LineDecoder decoder = { AnnotateObjdumpLines };
+	static const struct LineDecoder tracker = { TrackObjdumpLines };
+
+	if (PeepholeEnabled) {
+		RunLineDecoder(out, path, 1, &tracker);
 	}
-	if ((2 == argc) && (!strcmp(argv[1], "stdin"))) {
-		RunStdinDecoder();
-		exit(0);
+	else {
+		RunLineDecoder(out, path, threads, &decoder);
 	}
-	if ((2 == argc) && (!strcmp(argv[1], "objdump"))) {
-		RunObjdumpDecoder();
-		exit(0);
+}
+
+/******************************************************************************
+ * Incremental objdump annotation
+ *****************************************************************************/
+
+/*
+ * With --peephole --incremental=FILE the listing is taken a unit at a
+ * time: the lines between two labels (or other lines with a colon that
+ * are not instructions), usually a function. A unit is first only
+ * scanned for its opcodes, without following the registers. One without
+ * an MCR/MRC gets no annotations and is echoed as it is. The others are
+ * looked up in the cache file by a hash of their opcodes, which leaves
+ * out the addresses, so the annotations of a function that only moved
+ * are spliced back in between spans of the unit, and only changed and
+ * new units are decoded. A unit that read the PC only matches at the
+ * same address, and one with literal loads reaching before its start is
+ * not cached. The output is the same as without the cache.
+ *
+ * Without --peephole the annotations take no more work to make than to
+ * look up: replaying a warm cache measured slower than a full -j 1 run
+ * (0.17 s against 0.12 s on a 5M line listing), so the mode is only
+ * for --peephole, and is serial like it.
+ */
+enum {
+	/* Longer units are decoded as they come, without the cache */
+	INCREMENTAL_MAX_LINES = 1 << 16,
+};
+
+enum UnitLineKind {
+	/* Thumb halfwords and the like */
+	UnitOther,
+	UnitInsn,
+	UnitData,
+};
+
+/* A data word of the unit, for the literal loads of the units that follow */
+struct UnitWord {
+	uint32_t addr;
+	uint32_t word;
+};
+
+struct IncrementalRun {
+	struct Output *out;
+	/* Collects the annotations of a line to be cached */
+	struct Output scratch;
+	struct IncrementalCache cache;
+	struct Peephole ph;
+	struct DeferredValues deferred;
+
+	/*
+	 * The lines of the unit so far, in the input, or in copy once the
+	 * read buffer of piped input was recycled under it.
+	 */
+	const char *unit;
+	size_t unitLength;
+	size_t numLines;
+	bool copied;
+	char *copy;
+	size_t copyCapacity;
+
+	uint64_t hash;
+	/* Of the first ARM word */
+	uint32_t addr;
+	bool haveAddr;
+	bool hasAccess;
+	/*
+	 * Where each line that may be annotated ends in the unit: those with
+	 * an access, and pool words, which MCRs before them may wait on
+	 */
+	size_t *lineEnds;
+	size_t numLineEnds;
+	size_t maxLineEnds;
+	struct UnitWord *words;
+	size_t numWords;
+	size_t maxWords;
+	/* The unit got too long and is decoded as it comes */
+	bool streaming;
+};
+
+static inline uint64_t HashBytes(uint64_t hash, const void *data, size_t length)
+{
+	const uint8_t *p = data;
+
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ p[i]) * 0x100000001b3ull;
+	}
+	return hash;
+}
+
+static inline uint64_t HashString(uint64_t hash, const char *s)
+{
+	return HashBytes(hash, s ? s : "", s ? (strlen(s) + 1) : 1);
+}
+
+/**
+ * The annotations depend on the options and on the register database,
+ * so a cache is only used with the same ones.
+ */
+static uint64_t IncrementalOptions(void)
+{
+	uint64_t hash = HashBytes(0xcbf29ce484222325ull, &IsaMask, sizeof(IsaMask));
+
+	hash = HashBytes(hash, &PeepholeEnabled, sizeof(PeepholeEnabled));
+	for (size_t i = 0; i < ArmCoproRegCount(); i++) {
+		struct ArmCoproReg reg;
+		ArmCoproRegGet(i, &reg);
+		uint32_t key[] = { reg.isa, reg.cp, reg.wide, reg.crn, reg.op1, reg.crm, reg.op2,
+			reg.numFields };
+		hash = HashBytes(hash, key, sizeof(key));
+		hash = HashString(HashString(hash, reg.name), reg.comment);
+		for (size_t j = 0; j < reg.numFields; j++) {
+			struct ArmCoproField field;
+			ArmCoproFieldGet(&reg, j, &field);
+			uint32_t bits[] = { field.isa, field.lsb, field.width };
+			hash = HashString(HashBytes(hash, bits, sizeof(bits)), field.name);
+		}
+	}
+	return hash;
+}
+
+/**
+ * Add an opcode of the unit and how it was taken to the hash of the
+ * unit, a word at a time. The addresses and the disassembly are left
+ * out.
+ */
+static inline uint64_t HashUnitLine(uint64_t hash, enum UnitLineKind kind, uint32_t opcode)
+{
+	hash ^= ((uint64_t)kind << 32) | opcode;
+	hash *= 0x9e3779b97f4a7c15ull;
+	return hash ^ (hash >> 29);
+}
+
+static void *ReallocOrDie(void *ptr, size_t size)
+{
+	void *ret = realloc(ptr, size);
+	if (!ret) {
+		perror("realloc");
+		exit(1);
+	}
+	return ret;
+}
+
+/**
+ * Annotate and follow the lines of the unit, as TrackObjdumpLines does.
+ * When caching, the annotations go through the scratch buffer into a
+ * record for the access or pool word they follow.
+ */
+static void DecodeUnit(struct IncrementalRun *run, bool record)
+{
+	struct Output *out = record ? &run->scratch : run->out;
+	struct InputStream in;
+	struct InputLine line;
+	uint32_t index = 0;
+
+	InputOpenMemory(&in, run->unit, run->unitLength);
+	while (InputReadLine(&in, &line)) {
+		uint32_t val = 0;
+		uint32_t addr = 0;
+		bool data = false;
+
+		OutputSpan(run->out, line.start, line.length);
+		if (!ParseObjdumpLine(&line, &val)) {
+			continue;
+		}
+		if (IsCoproAccess(val)) {
+			DecodeMrcAndPrint(out, val);
+		}
+
+		if (!ParseObjdumpWord(&line, &addr, &data)) {
+			/* Thumb code is not followed */
+			PeepholeReset(&run->ph);
+		}
+		else {
+			if (run->deferred.count) {
+				ResolveDeferredValues(out, &run->deferred, addr, val, data);
+			}
+			if (data) {
+				PeepholeData(&run->ph, addr, val);
+			}
+			else {
+				PrintWrittenValue(out, &run->ph, &run->deferred, val);
+				PeepholeStep(&run->ph, addr, val);
+			}
+		}
+
+		if ((IsCoproAccess(val) || data) && record) {
+			size_t length = run->scratch.pending;
+			if (length) {
+				char *p = IncrementalReserve(&run->cache, index, length);
+				OutputGather(&run->scratch, p);
+				OutputCopy(run->out, p, length);
+			}
+			index++;
+		}
+	}
+	InputClose(&in);
+}
+
+/**
+ * Echo the unit with the cached annotations spliced in after the lines
+ * they follow.
+ */
+static void ReplayUnit(struct IncrementalRun *run, const char *records, size_t length)
+{
+	size_t pos = 0;
+	uint32_t index = 0;
+	const char *text = NULL;
+	uint32_t textLength = 0;
+
+	while (IncrementalNextRecord(&records, &length, &index, &text, &textLength)
+			&& (index < run->numLineEnds)) {
+		size_t end = run->lineEnds[index];
+		OutputSpan(run->out, run->unit + pos, end - pos);
+		OutputSpan(run->out, text, textLength);
+		pos = end;
+	}
+	OutputSpan(run->out, run->unit + pos, run->unitLength - pos);
+}
+
+/**
+ * The values of the registers are forgotten at the next label anyway, so
+ * a unit that is not decoded only leaves its data words behind.
+ */
+static void KeepUnitWords(struct IncrementalRun *run)
+{
+	for (size_t i = 0; i < run->numWords; i++) {
+		PeepholeData(&run->ph, run->words[i].addr, run->words[i].word);
+	}
+}
+
+static void ClearUnit(struct IncrementalRun *run)
+{
+	run->unitLength = 0;
+	run->numLines = 0;
+	run->copied = false;
+	run->hash = 0xcbf29ce484222325ull;
+	run->haveAddr = false;
+	run->hasAccess = false;
+	run->numLineEnds = 0;
+	run->numWords = 0;
+}
+
+static void FinishUnit(struct IncrementalRun *run)
+{
+	const char *records = NULL;
+	size_t length = 0;
+
+	if (run->streaming) {
+		DecodeUnit(run, false);
+	}
+	else if (!run->hasAccess) {
+		OutputSpan(run->out, run->unit, run->unitLength);
+		KeepUnitWords(run);
+	}
+	else if (IncrementalLookup(&run->cache, run->hash, run->addr, &records, &length)) {
+		ReplayUnit(run, records, length);
+		KeepUnitWords(run);
+	}
+	else {
+		uint32_t dataMark = run->ph.dataSeen;
+		run->ph.lowestLiteral = UINT32_MAX;
+		run->ph.oldestLiteral = UINT32_MAX;
+		run->ph.readPc = false;
+
+		IncrementalBegin(&run->cache);
+		DecodeUnit(run, true);
+		bool keep = (run->ph.lowestLiteral >= run->addr) && (run->ph.oldestLiteral > dataMark);
+		IncrementalEnd(&run->cache, keep, run->hash, run->addr,
+				run->ph.readPc ? INCREMENTAL_POSITION : 0);
+	}
+
+	ClearUnit(run);
+	run->streaming = false;
+}
+
+/**
+ * Called before the read buffer of piped input is reused: what was echoed
+ * from it is written, and the unit so far moves to the copy, which takes
+ * the rest of its lines too.
+ */
+static void KeepUnitLines(void *arg)
+{
+	struct IncrementalRun *run = arg;
+
+	OutputFlush(run->out);
+	if (run->unitLength && !run->copied) {
+		if (run->unitLength > run->copyCapacity) {
+			run->copyCapacity = run->unitLength + (64 << 10);
+			run->copy = ReallocOrDie(run->copy, run->copyCapacity);
+		}
+		memcpy(run->copy, run->unit, run->unitLength);
+		run->unit = run->copy;
+		run->copied = true;
+	}
+}
+
+static void AddUnitLine(struct IncrementalRun *run, const struct InputLine *line)
+{
+	if (!run->unitLength) {
+		run->unit = line->start;
+	}
+	if (run->copied) {
+		if (run->unitLength + line->length > run->copyCapacity) {
+			while (run->unitLength + line->length > run->copyCapacity) {
+				run->copyCapacity *= 2;
+			}
+			run->copy = ReallocOrDie(run->copy, run->copyCapacity);
+			run->unit = run->copy;
+		}
+		memcpy(run->copy + run->unitLength, line->start, line->length);
+	}
+	run->unitLength += line->length;
+
+	if (++run->numLines == INCREMENTAL_MAX_LINES) {
+		DecodeUnit(run, false);
+		ClearUnit(run);
+		run->streaming = true;
+	}
+}
+
+static void AnnotateObjdumpIncrementally(struct IncrementalRun *run, struct InputStream *in)
+{
+	struct InputLine line;
+	uint64_t lines = 0;
+	uint64_t bytes = 0;
+
+	ClearUnit(run);
+	while (InputReadLine(in, &line)) {
+		uint32_t opcode = 0;
+		bool data = false;
+
+		lines++;
+		bytes += line.length;
+
+		if (!ParseObjdumpLine(&line, &opcode)) {
+			if (line.colon) {
+				/* Function labels start from scratch */
+				FinishUnit(run);
+				OutputSpan(run->out, line.start, line.length);
+				PeepholeReset(&run->ph);
+				run->deferred.count = 0;
+				continue;
+			}
+			AddUnitLine(run, &line);
+			continue;
+		}
+
+		enum UnitLineKind kind = UnitOther;
+		if (IsObjdumpWord(&line, &data)) {
+			kind = data ? UnitData : UnitInsn;
+			if (data || !run->haveAddr) {
+				uint32_t addr = ParseObjdumpAddress(line.start, line.colon);
+				if (!run->haveAddr) {
+					run->addr = addr;
+					run->haveAddr = true;
+				}
+				if (data) {
+					if (run->numWords == run->maxWords) {
+						run->maxWords = run->maxWords ? (2 * run->maxWords) : 64;
+						run->words = ReallocOrDie(run->words,
+								run->maxWords * sizeof(run->words[0]));
+					}
+					run->words[run->numWords++] = (struct UnitWord){ addr, opcode };
+				}
+			}
+		}
+		run->hash = HashUnitLine(run->hash, kind, opcode);
+
+		run->hasAccess |= IsCoproAccess(opcode);
+		if (IsCoproAccess(opcode) || (kind == UnitData)) {
+			if (run->numLineEnds == run->maxLineEnds) {
+				run->maxLineEnds = run->maxLineEnds ? (2 * run->maxLineEnds) : 64;
+				run->lineEnds = ReallocOrDie(run->lineEnds,
+						run->maxLineEnds * sizeof(run->lineEnds[0]));
+			}
+			run->lineEnds[run->numLineEnds++] = run->unitLength + line.length;
+		}
+		AddUnitLine(run, &line);
+	}
+	FinishUnit(run);
+	StatsAdd(StatLines, lines);
+	StatsAdd(StatBytes, bytes);
+}
+
+static inline void RunIncrementalObjdump(struct Output *out, const char *path,
+		const char *cachePath)
+{
+	struct IncrementalRun run = { .out = out };
+	struct InputStream in;
+
+	OpenInputOrDie(&in, path);
+	IncrementalOpen(&run.cache, cachePath, IncrementalOptions());
+	OutputInitBuffer(&run.scratch);
+	PeepholeInit(&run.ph, NULL, NULL);
+
+	struct StatsLoop loop;
+	StatsLoopStart(&loop);
+	InputSetFillHook(&in, KeepUnitLines, &run);
+	AnnotateObjdumpIncrementally(&run, &in);
+	/* The output refers to the input and the old cache file until here */
+	OutputFlush(out);
+	IncrementalSave(&run.cache);
+	StatsLoopStop(&loop);
+
+	IncrementalClose(&run.cache);
+	OutputFree(&run.scratch);
+	InputClose(&in);
+	free(run.copy);
+	free(run.lineEnds);
+	free(run.words);
+}
+
+/******************************************************************************
+ * Thumb-2 coprocessor accesses
+ *****************************************************************************/
+
+/*
+ * Thumb-2 MCR/MRC and MCRR/MRRC formats (T1 and T2), as two halfwords:
+ * 15   11   7    3      15   11   7    3
+ * 111Y 1110 OP1L CR_N   R__D 1Y1Y OP21 CR_M
+ * 111Y 1100 010L RD_2   R__D 1Y1Y OP1_ CR_M
+ * Taken as the word (first << 16 | second), the fields are where they
+ * are in the ARM encoding, so it is decoded the same way.
+ */
+enum {
+	MaskThumbMcrMrc_First = 0xEF00,
+	ThumbMcrMrc_First = 0xEE00,
+	MaskThumbMcrMrc_Second = MaskCoproSpace | BIT(4),
+	ThumbMcrMrc_Second = MaskCoproSpace | BIT(4),
+	MaskThumbMcrr_First = 0xEFE0,
+	ThumbMcrr_First = 0xEC40,
+	MaskThumbMcrr_Second = MaskCoproSpace,
+	ThumbMcrr_Second = MaskCoproSpace,
+};
+
+static inline bool IsThumbCoproFirst(uint32_t hw1)
+{
+	return ((hw1 & MaskThumbMcrMrc_First) == ThumbMcrMrc_First)
+		| ((hw1 & MaskThumbMcrr_First) == ThumbMcrr_First);
+}
+
+static inline bool IsThumbCoproAccess(uint32_t hw1, uint32_t hw2)
+{
+	return ((hw1 >> 13) == 7) && IsCoproAccess((hw1 << 16) | hw2);
+}
+
+/******************************************************************************
+ * ELF scanning
+ *****************************************************************************/
+
+static inline bool HostIsBigEndian(void)
+{
+	return __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__;
+}
+
+/**
+ * Print "ADDRESS <FUNCTION+0xOFFSET>: OPCODE" for an instruction found
+ * in an ELF file, in the same spirit as the objdump listing.
+ */
+static void PrintElfLocation(struct Output *out, const struct ElfImage *img,
+		uint16_t section, uint32_t addr, uint32_t opcode)
+{
+	const struct ElfFunction *func = ElfFindFunction(img, section, addr);
+	char *p = OutputReserve(out, 64 + (func ? strlen(func->name) : 0));
+
+	p = FormatHex32(p, addr);
+	if (func) {
+		p = FormatString(p, " <");
+		p = FormatString(p, func->name);
+		if (addr != func->addr) {
+			p = FormatString(p, "+0x");
+			p = FormatHex(p, addr - func->addr);
+		}
+		p = FormatString(p, ">");
+	}
+	p = FormatString(p, ": ");
+	p = FormatHex32(p, opcode);
+	p = FormatString(p, "\n");
+	OutputCommit(out, p);
+}
+
+typedef void (*ElfAccessFn)(uint32_t addr, uint32_t opcode, void *arg);
+
+/**
+ * Walk a region of Thumb code instruction by instruction, so that the
+ * second halfword of a 32-bit instruction is never taken for the first,
+ * and call fn for each coprocessor access.
+ */
+static void FindElfThumbAccesses(const struct ElfImage *img, const struct ElfRegion *region,
+		ElfAccessFn fn, void *arg)
+{
+	bool swap = (img->codeBigEndian != HostIsBigEndian());
+	size_t skip = region->addr & 1;
+
+	if (region->size <= skip) {
+		return;
+	}
+	size_t n = (region->size - skip) / sizeof(uint16_t);
+	const uint8_t *data = region->data + skip;
+
+	for (size_t i = 0; i < n; i++) {
+		uint16_t hw1;
+		uint16_t hw2;
+		memcpy(&hw1, data + i * sizeof(hw1), sizeof(hw1));
+		hw1 = swap ? __builtin_bswap16(hw1) : hw1;
+		/* 0b11101, 0b11110 and 0b11111 start a 32-bit instruction */
+		if (((hw1 >> 11) < 0x1d) || (i + 1 == n)) {
+			continue;
+		}
+		memcpy(&hw2, data + ++i * sizeof(hw2), sizeof(hw2));
+		hw2 = swap ? __builtin_bswap16(hw2) : hw2;
+		if (IsThumbCoproAccess(hw1, hw2)) {
+			fn(region->addr + skip + (i - 1) * sizeof(hw1), ((uint32_t)hw1 << 16) | hw2, arg);
+		}
+	}
+}
+
+/**
+ * Find the coprocessor accesses in a region of ARM code. The words are
+ * tested several at a time in the byte order of the file, and only the
+ * hits are byte-swapped and decoded.
+ */
+static void ScanElfArmRegion(struct Output *out, const struct ElfImage *img,
+		const struct ElfRegion *region)
+{
+	bool swap = (img->codeBigEndian != HostIsBigEndian());
+	struct WordPattern pattern = COPRO_ACCESS_PATTERN;
+	size_t skip = (4 - (region->addr & 3)) & 3;
+
+	if (region->size <= skip) {
+		return;
+	}
+	const uint8_t *data = region->data + skip;
+	size_t n = (region->size - skip) / sizeof(uint32_t);
+
+	if (swap) {
+		pattern = WordPatternSwap(pattern);
+	}
+	for (size_t i = FindWordPattern(data, n, 0, &pattern); i < n;
+			i = FindWordPattern(data, n, i + 1, &pattern)) {
+		uint32_t opcode;
+		memcpy(&opcode, data + i * sizeof(opcode), sizeof(opcode));
+		if (swap) {
+			opcode = __builtin_bswap32(opcode);
+		}
+
+		PrintElfLocation(out, img, region->section,
+				region->addr + skip + i * sizeof(opcode), opcode);
+		DecodeMrcAndPrint(out, opcode);
+	}
+}
+
+struct ElfThumbScan {
+	struct Output *out;
+	const struct ElfImage *img;
+	uint16_t section;
+};
+
+static void PrintElfThumbAccess(uint32_t addr, uint32_t opcode, void *arg)
+{
+	const struct ElfThumbScan *scan = arg;
+
+	PrintElfLocation(scan->out, scan->img, scan->section, addr, opcode);
+	DecodeMrcAndPrint(scan->out, opcode);
+}
+
+/**
+ * Thumb code is annotated in peephole mode too, only its register values
+ * are not followed.
+ */
+static void ScanElfThumbRegion(struct Output *out, const struct ElfImage *img,
+		const struct ElfRegion *region)
+{
+	struct ElfThumbScan scan = { out, img, region->section };
+	FindElfThumbAccesses(img, region, PrintElfThumbAccess, &scan);
+}
+
+struct ElfLiteralContext {
+	const struct ElfImage *img;
+	uint16_t section;
+};
+
+static bool ReadElfLiteral(void *ctx, uint32_t addr, uint32_t *word)
+{
+	const struct ElfLiteralContext *lit = ctx;
+	return ElfReadWord(lit->img, lit->section, addr, word);
+}
+
+/**
+ * Follow every instruction of a region of ARM code for the peephole
+ * mode, taking literals from the section.
+ */
+static void TrackElfArmRegion(struct Output *out, const struct ElfImage *img,
+		const struct ElfRegion *region)
+{
+	struct ElfLiteralContext lit = { img, region->section };
+	struct Peephole ph;
+	bool swap = (img->codeBigEndian != HostIsBigEndian());
+	size_t skip = (4 - (region->addr & 3)) & 3;
+
+	if (region->size <= skip) {
+		return;
+	}
+	const uint8_t *data = region->data + skip;
+	size_t n = (region->size - skip) / sizeof(uint32_t);
+
+	PeepholeInit(&ph, ReadElfLiteral, &lit);
+	for (size_t i = 0; i < n; i++) {
+		uint32_t addr = region->addr + skip + i * sizeof(uint32_t);
+		uint32_t opcode;
+		memcpy(&opcode, data + i * sizeof(opcode), sizeof(opcode));
+		if (swap) {
+			opcode = __builtin_bswap32(opcode);
+		}
+
+		if (IsCoproAccess(opcode)) {
+			PrintElfLocation(out, img, region->section, addr, opcode);
+			DecodeMrcAndPrint(out, opcode);
+			PrintWrittenValue(out, &ph, NULL, opcode);
+		}
+		PeepholeStep(&ph, addr, opcode);
+	}
+}
+
+static inline void RunElfScanner(struct Output *out, const char *path)
+{
+	struct ElfImage img;
+	const char *error = NULL;
+
+	if (!path) {
+		fprintf(stderr, "elf mode needs a file name\n");
+		exit(1);
+	}
+	if (!ElfOpen(&img, path, &error)) {
+		fprintf(stderr, "%s: %s\n", path, error);
+		exit(1);
+	}
+
+	for (size_t i = 0; i < img.numRegions; i++) {
+		if (img.regions[i].kind == ElfCodeThumb) {
+			ScanElfThumbRegion(out, &img, &img.regions[i]);
+		}
+		else if (img.regions[i].kind != ElfCodeArm) {
+			continue;
+		}
+		else if (PeepholeEnabled) {
+			TrackElfArmRegion(out, &img, &img.regions[i]);
+		}
+		else {
+			ScanElfArmRegion(out, &img, &img.regions[i]);
+		}
+	}
+	OutputFlush(out);
+	ElfClose(&img);
+}
+
+/******************************************************************************
+ * Raw image scanning
+ *****************************************************************************/
+
+/*
+ * A raw image has no headers telling its byte order, so every offset is
+ * tried both as little-endian code (which BE8 images use as well) and as
+ * BE32 code.
+ */
+enum RawEncoding {
+	RawArm,
+	RawArmBe32,
+	RawThumb,
+	RawThumbBe32,
+	/* The same word read either way, see ScanRawOffset */
+	RawArmThumbBe32,
+};
+
+static const char *const RawEncodingNames[] = {
+	[RawArm] = "arm",
+	[RawArmBe32] = "arm-be32",
+	[RawThumb] = "thumb",
+	[RawThumbBe32] = "thumb-be32",
+	[RawArmThumbBe32] = "arm/thumb-be32",
+};
+
+enum {
+	/* "OFFSET ENCODING OPCODE MRC rN NAME[/NAME]\n" */
+	/* The names take less room than in an annotation */
+	RAW_HIT_MAX = 64 + ARMCOPRO_FORMAT_MAX,
+};
+
+struct RawImage {
+	const uint8_t *data;
+	size_t size;
+};
+
+/**
+ * Print "OFFSET ENCODING OPCODE MCR|MRC rN NAME[/NAME]", or "MRRC rN,rM"
+ * and so on for the 64-bit form, for an access to a known register.
+ * Anything else is most likely data that happens to look like an
+ * access, which would only bury the interesting hits.
+ */
+static void PrintRawHit(struct Output *out, size_t offset, enum RawEncoding encoding,
+		uint32_t opcode)
+{
+	struct ArmCoproInsn insn;
+
+	ArmCoproDecode(opcode, IsaMask, &insn);
+	if (!insn.numRegs) {
+		return;
+	}
+
+	char *p = OutputReserve(out, RAW_HIT_MAX);
+	if ((uint64_t)offset >> 32) {
+		p = FormatHex(p, (uint64_t)offset >> 32);
+	}
+	p = FormatHex32(p, (uint32_t)offset);
+	p = FormatString(p, " ");
+	p = FormatString(p, RawEncodingNames[encoding]);
+	p = FormatString(p, " ");
+	p = FormatHex32(p, opcode);
+	if (insn.wide) {
+		p = FormatString(p, insn.mrc ? " MRRC r" : " MCRR r");
+	}
+	else {
+		p = FormatString(p, insn.mrc ? " MRC r" : " MCR r");
+	}
+	p = FormatUnsigned(p, insn.rd);
+	if (insn.wide) {
+		p = FormatString(p, ",r");
+		p = FormatUnsigned(p, insn.rd2);
+	}
+	for (size_t i = 0; i < insn.numRegs; i++) {
+		p = FormatString(p, i ? "/" : " ");
+		p = FormatString(p, insn.regs[i].name ? insn.regs[i].name : "Unknown");
+	}
+	p = FormatString(p, "\n");
+	OutputCommit(out, p);
+}
+
+/**
+ * Check which encodings match at a candidate offset. ARM instructions
+ * are word-aligned, Thumb ones only halfword-aligned. In BE32 a 32-bit
+ * Thumb instruction has its bytes in the same order as an ARM word, so
+ * at an aligned offset the two read the same opcode (an unconditional
+ * ARM access is a valid Thumb-2 one); such a hit is printed once.
+ */
+static void ScanRawOffset(struct Output *out, const struct RawImage *img, size_t offset)
+{
+	const uint8_t *b = img->data + offset;
+	uint32_t first = b[0] | (b[1] << 8);
+	uint32_t second = b[2] | (b[3] << 8);
+	uint16_t hw1 = first;
+	uint16_t hw2 = second;
+	uint16_t hw1Be = __builtin_bswap16(first);
+	uint16_t hw2Be = __builtin_bswap16(second);
+	bool thumbBe = IsThumbCoproAccess(hw1Be, hw2Be);
+
+	if (!(offset & 3)) {
+		uint32_t word = first | (second << 16);
+		if (IsCoproAccess(word)) {
+			PrintRawHit(out, offset, RawArm, word);
+		}
+		if (IsCoproAccess(__builtin_bswap32(word))) {
+			PrintRawHit(out, offset, thumbBe ? RawArmThumbBe32 : RawArmBe32,
+					__builtin_bswap32(word));
+			thumbBe = false;
+		}
+	}
+
+	if (IsThumbCoproAccess(hw1, hw2)) {
+		PrintRawHit(out, offset, RawThumb, ((uint32_t)hw1 << 16) | hw2);
+	}
+	if (thumbBe) {
+		PrintRawHit(out, offset, RawThumbBe32, ((uint32_t)hw1Be << 16) | hw2Be);
+	}
+}
+
+struct RawChunk {
+	struct Output *out;
+	const struct RawImage *img;
+};
+
+static void ScanRawCandidate(size_t offset, void *arg)
+{
+	const struct RawChunk *chunk = arg;
+	ScanRawOffset(chunk->out, chunk->img, offset);
+}
+
+/**
+ * Scan [start, end) of the image. The candidates are found several
+ * offsets at a time; instructions starting in the chunk may extend
+ * past its end.
+ */
+static void ScanRawChunk(struct Output *out, const char *start, const char *end, void *arg)
+{
+	static const struct RawPattern pattern = {
+		.wordMask = { MaskCoproReg, MaskCoproWide },
+		.wordValue = { ValueCoproReg, ValueCoproWide },
+		.firstMask = { MaskThumbMcrMrc_First, MaskThumbMcrr_First },
+		.firstValue = { ThumbMcrMrc_First, ThumbMcrr_First },
+		.secondMask = { MaskThumbMcrMrc_Second, MaskThumbMcrr_Second },
+		.secondValue = { ThumbMcrMrc_Second, ThumbMcrr_Second },
+	};
+	struct RawChunk chunk = { out, arg };
+	size_t from = (const uint8_t *)start - chunk.img->data;
+	size_t to = (const uint8_t *)end - chunk.img->data;
+	/* The last instruction may start two bytes before the end */
+	size_t limit = (chunk.img->size - to > 2) ? (to + 2) : chunk.img->size;
+
+	FindRawCandidates(chunk.img->data, limit, from, to, &pattern, ScanRawCandidate, &chunk);
+}
+
+static inline void RunRawScanner(struct Output *out, const char *path, unsigned threads)
+{
+	struct InputStream in;
+
+	if (!path) {
+		fprintf(stderr, "raw mode needs a file name\n");
+		exit(1);
+	}
+	OpenInputOrDie(&in, path);
+	if (!in.mapped) {
+		if (!in.eof) {
+			fprintf(stderr, "%s: not a regular file\n", path);
+			exit(1);
+		}
+		InputClose(&in);
+		return;
+	}
+
+	struct RawImage img = {
+		.data = (const uint8_t *)in.data,
+		.size = in.size,
+	};
+	OutputFlush(out);
+	if ((threads > 1) && RunChunked(in.data, in.size, threads, ChunkBoundaryWord,
+				ScanRawChunk, &img, out->fd)) {
+		InputClose(&in);
+		return;
+	}
+	ScanRawChunk(out, in.data, in.data + in.size, &img);
+	OutputFlush(out);
+	InputClose(&in);
+}
+
+/******************************************************************************
+ * Access summary
+ *****************************************************************************/
+
+/*
+ * With --summary the objdump and elf modes only collect the accesses and
+ * write them as CSV at the end, grouped by register, direction and the
+ * function they are in, instead of the annotated listing. Unlike the
+ * annotating modes, the summary covers 32-bit Thumb instructions too.
+ * With --columnar the same hits are written as binary columns, one
+ * record per access, for tools that would otherwise parse the listing.
+ */
+static bool SummaryEnabled;
+static bool ColumnarEnabled;
+
+static void WriteSummary(const struct Summary *summary, struct Output *out)
+{
+	if (ColumnarEnabled) {
+		SummaryWriteColumns(summary, out, IsaMask);
+	}
+	else {
+		SummaryWrite(summary, out, IsaMask);
+	}
+	OutputFlush(out);
+}
+
+/**
+ * Objdump prints a 32-bit Thumb instruction as two halfwords, e.g.
+ * "ee11 0f10". Get both as a word the way the raw scanner does.
+ */
+static bool ParseObjdumpThumbWord(const struct InputLine *line, uint32_t *opcode)
+{
+	const char *end = line->start + line->length;
+	const char *p = line->colon + 1;
+
+	while ((p < end) && ((*p == ' ') || (*p == '\t'))) {
+		p++;
+	}
+	if ((end - p < 9) || (p[4] != ' ') || ((end - p > 9) && IsHexDigit(p[9]))) {
+		return false;
+	}
+	for (size_t i = 0; i < 4; i++) {
+		if (!IsHexDigit(p[i]) || !IsHexDigit(p[5 + i])) {
+			return false;
+		}
+	}
+	*opcode = (ParseHexScalar(p, p + 4) << 16) | ParseHexScalar(p + 5, p + 9);
+	return true;
+}
+
+/**
+ * Take the function name from a label line, "ADDRESS <NAME>:". Mapping
+ * symbols ($a, $t, $d) do not start a function. Any other line ending in
+ * a colon, e.g. a section header, ends the function.
+ */
+static void SummarizeObjdumpLabel(struct Summary *summary, const struct InputLine *line)
+{
+	const char *end = line->start + line->length;
+	const char *name = memchr(line->start, '<', line->length);
+
+	while ((end > line->start) && ((end[-1] == '\n') || (end[-1] == '\r'))) {
+		end--;
+	}
+	if (name && (end - name >= 3) && (end[-1] == ':') && (end[-2] == '>')) {
+		if (name[1] != '$') {
+			SummaryEnterFunction(summary, name + 1, end - 2 - (name + 1));
+		}
+	}
+	else {
+		SummaryEnterFunction(summary, NULL, 0);
+	}
+}
+
+static void SummarizeObjdumpLines(struct Summary *summary, struct InputStream *in)
+{
+	struct InputLine line;
+
+	while (InputReadLine(in, &line)) {
+		uint32_t val = 0;
+		uint32_t addr = 0;
+		bool data = false;
+
+		if (!ParseObjdumpLine(&line, &val)) {
+			if (line.colon) {
+				SummarizeObjdumpLabel(summary, &line);
+			}
+			continue;
+		}
+		if (IsCoproAccess(val)) {
+			if (ParseObjdumpWord(&line, &addr, &data) && !data) {
+				SummaryAdd(summary, addr, val);
+			}
+		}
+		else if (IsThumbCoproFirst(val)
+				&& ParseObjdumpThumbWord(&line, &val)
+				&& IsThumbCoproAccess(val >> 16, val & 0xffff)) {
+			SummaryAdd(summary, ParseObjdumpAddress(line.start, line.colon), val);
+		}
+	}
+}
+
+/**
+ * Labels carry over from one part of the listing to the next, so the
+ * listing is read serially.
+ */
+static inline void RunObjdumpSummary(struct Output *out, const char *path)
+{
+	struct InputStream in;
+	struct Summary summary;
+
+	OpenInputOrDie(&in, path);
+	SummaryInit(&summary);
+	SummarizeObjdumpLines(&summary, &in);
+	InputClose(&in);
+
+	WriteSummary(&summary, out);
+	SummaryFree(&summary);
+}
+
+static void SummarizeElfHit(struct Summary *summary, const struct ElfImage *img,
+		uint16_t section, uint32_t addr, uint32_t opcode, const struct ElfFunction **func)
+{
+	const struct ElfFunction *found = ElfFindFunction(img, section, addr);
+
+	if (found != *func) {
+		SummaryEnterFunction(summary, found ? found->name : NULL,
+				found ? strlen(found->name) : 0);
+		*func = found;
+	}
+	SummaryAdd(summary, addr, opcode);
+}
+
+static void SummarizeElfArmRegion(struct Summary *summary, const struct ElfImage *img,
+		const struct ElfRegion *region, const struct ElfFunction **func)
+{
+	bool swap = (img->codeBigEndian != HostIsBigEndian());
+	struct WordPattern pattern = COPRO_ACCESS_PATTERN;
+	size_t skip = (4 - (region->addr & 3)) & 3;
+
+	if (region->size <= skip) {
+		return;
+	}
+	const uint8_t *data = region->data + skip;
+	size_t n = (region->size - skip) / sizeof(uint32_t);
+
+	if (swap) {
+		pattern = WordPatternSwap(pattern);
+	}
+	for (size_t i = FindWordPattern(data, n, 0, &pattern); i < n;
+			i = FindWordPattern(data, n, i + 1, &pattern)) {
+		uint32_t opcode;
+		memcpy(&opcode, data + i * sizeof(opcode), sizeof(opcode));
+		if (swap) {
+			opcode = __builtin_bswap32(opcode);
+		}
+		SummarizeElfHit(summary, img, region->section,
+				region->addr + skip + i * sizeof(opcode), opcode, func);
+	}
+}
+
+struct ElfThumbSummary {
+	struct Summary *summary;
+	const struct ElfImage *img;
+	uint16_t section;
+	const struct ElfFunction **func;
+};
+
+static void SummarizeElfThumbAccess(uint32_t addr, uint32_t opcode, void *arg)
+{
+	const struct ElfThumbSummary *sum = arg;
+	SummarizeElfHit(sum->summary, sum->img, sum->section, addr, opcode, sum->func);
+}
+
+static void SummarizeElfThumbRegion(struct Summary *summary, const struct ElfImage *img,
+		const struct ElfRegion *region, const struct ElfFunction **func)
+{
+	struct ElfThumbSummary sum = { summary, img, region->section, func };
+	FindElfThumbAccesses(img, region, SummarizeElfThumbAccess, &sum);
+}
+
+static inline void RunElfSummary(struct Output *out, const char *path)
+{
+	struct ElfImage img;
+	struct Summary summary;
+	const struct ElfFunction *func = NULL;
+	const char *error = NULL;
+
+	if (!path) {
+		fprintf(stderr, "elf mode needs a file name\n");
+		exit(1);
+	}
+	if (!ElfOpen(&img, path, &error)) {
+		fprintf(stderr, "%s: %s\n", path, error);
+		exit(1);
+	}
+
+	SummaryInit(&summary);
+	for (size_t i = 0; i < img.numRegions; i++) {
+		if (img.regions[i].kind == ElfCodeArm) {
+			SummarizeElfArmRegion(&summary, &img, &img.regions[i], &func);
+		}
+		else if (img.regions[i].kind == ElfCodeThumb) {
+			SummarizeElfThumbRegion(&summary, &img, &img.regions[i], &func);
+		}
+	}
+	WriteSummary(&summary, out);
+	SummaryFree(&summary);
+	ElfClose(&img);
+}
+
+/******************************************************************************
+ * Decode server
+ *****************************************************************************/
+
+/*
+ * The kinds of requests the serve mode answers. Opcodes come as an array
+ * of little-endian words and each is answered by its annotation, if any,
+ * and an empty line. Hex lines and objdump listings are answered exactly
+ * as by the stdin and objdump modes. The annotation cache lives as long
+ * as the server, so repeated opcodes are formatted only once.
+ */
+enum ServeRequest {
+	ServeOpcodes = 1,
+	ServeHexLines = 2,
+	ServeObjdump = 3,
+};
+
+enum ServeStatus {
+	ServeOk = 0,
+	ServeUnknownRequest = 1,
+	ServeBadPayload = 2,
+};
+
+static uint32_t HandleServeRequest(struct Output *out, uint32_t kind,
+		const char *payload, size_t length, void *arg)
+{
+	struct InputStream in;
+
+	(void)arg;
+	switch (kind) {
+	case ServeOpcodes:
+		if (length % sizeof(uint32_t)) {
+			return ServeBadPayload;
+		}
+		for (size_t i = 0; i < length; i += sizeof(uint32_t)) {
+			uint32_t opcode;
+			memcpy(&opcode, payload + i, sizeof(opcode));
+			DecodeMrcAndPrint(out, HostIsBigEndian() ? __builtin_bswap32(opcode) : opcode);
+			OutputCopy(out, "\n", 1);
+		}
+		return ServeOk;
+	case ServeHexLines:
+		InputOpenMemory(&in, payload, length);
+		DecodeHexLines(out, &in);
+		InputClose(&in);
+		return ServeOk;
+	case ServeObjdump:
+		InputOpenMemory(&in, payload, length);
+		if (PeepholeEnabled) {
+			TrackObjdumpLines(out, &in);
+		}
+		else {
+			AnnotateObjdumpLines(out, &in);
+		}
+		InputClose(&in);
+		return ServeOk;
+	default:
+		return ServeUnknownRequest;
+	}
+}
+
+static inline bool RunDecodeServer(const char *path)
+{
+	if (!path) {
+		fprintf(stderr, "serve mode needs a socket path\n");
+		exit(1);
+	}
+	return RunServer(path, HandleServeRequest, NULL);
+}
+
+/******************************************************************************
+ * Benchmarks
+ *****************************************************************************/
+
+/*
+ * The benchmark runs the serial decoders of each mode over corpora
+ * generated in memory, writing to /dev/null, so the numbers depend on
+ * the decoder and not on the disk or the terminal. The corpora are the
+ * same on every run. There is one line of results per corpus. Given the
+ * output of an earlier run as a baseline, the benchmark fails if any
+ * corpus is more than BENCH_TOLERANCE percent slower per item.
+ */
+enum {
+	BENCH_WARMUP_RUNS = 1,
+	BENCH_RUNS = 5,
+	BENCH_TOLERANCE = 15,
+	BENCH_LINES = 1 << 20,
+	BENCH_RAW_SIZE = 64 << 20,
+	/* A coprocessor access every this many instructions */
+	BENCH_MCR_INTERVAL = 64,
+	BENCH_FUNCTION_LINES = 32,
+	BENCH_MAX_CORPUS_NAME = 32,
+	/* Distinct encodings in the "repeat" corpus, as in real code */
+	BENCH_WORKING_SET = 64,
+};
+
+struct BenchBuffer {
+	char *data;
+	size_t size;
+	size_t capacity;
+};
+
+struct BenchCorpus {
+	const char *name;
+	/* Generate the corpus into buf, returning the number of items in it */
+	size_t (*generate)(struct BenchBuffer *buf, uint32_t *seed);
+	void (*run)(struct Output *out, const char *data, size_t size);
+};
+
+static void BenchReserve(struct BenchBuffer *buf, size_t length)
+{
+	if (buf->size + length <= buf->capacity) {
+		return;
+	}
+	size_t capacity = buf->capacity ? buf->capacity : (1 << 20);
+	while (capacity < buf->size + length) {
+		capacity *= 2;
+	}
+	buf->data = realloc(buf->data, capacity);
+	if (!buf->data) {
+		perror("bench");
+		exit(1);
+	}
+	buf->capacity = capacity;
+}
+
+static void BenchPrintf(struct BenchBuffer *buf, const char *fmt, ...)
+{
+	va_list args;
+
+	BenchReserve(buf, 256);
+	va_start(args, fmt);
+	int n = vsnprintf(buf->data + buf->size, buf->capacity - buf->size, fmt, args);
+	va_end(args);
+	if ((n > 0) && ((size_t)n < buf->capacity - buf->size)) {
+		buf->size += n;
+	}
+}
+
+static uint32_t BenchRandom(uint32_t *seed)
+{
+	uint32_t x = *seed;
+	x ^= x << 13;
+	x ^= x >> 17;
+	x ^= x << 5;
+	return *seed = x;
+}
+
+/**
+ * An MCR/MRC with random operands, accessing a known register half of
+ * the time.
+ */
+static uint32_t BenchMcr(uint32_t *seed)
+{
+	uint32_t opcode = (BenchRandom(seed) & ~(Mask_Op1_CRm_Op2_CRn | MaskMcrMrc)) | ValueMcrMrc;
+
+	if (BenchRandom(seed) & 1) {
+		struct ArmCoproReg reg;
+		/* The listing prints every access as CP15 MCR/MRC */
+		do {
+			ArmCoproRegGet(BenchRandom(seed) % ArmCoproRegCount(), &reg);
+		} while (reg.wide || (reg.cp != 15));
+		return opcode | Pack(CRn, reg.crn) | Pack(Op1, reg.op1)
+			| Pack(CRm, reg.crm) | Pack(Op2, reg.op2);
+	}
+	return opcode | (BenchRandom(seed) & Mask_Op1_CRm_Op2_CRn);
+}
+
+static size_t BenchGenerateWords(struct BenchBuffer *buf, uint32_t *seed)
+{
+	for (size_t i = 0; i < BENCH_LINES; i++) {
+		BenchPrintf(buf, (i & 1) ? "0x%08x\n" : "%08x\n", BenchRandom(seed));
+	}
+	return BENCH_LINES;
+}
+
+static size_t BenchGenerateDense(struct BenchBuffer *buf, uint32_t *seed)
+{
+	for (size_t i = 0; i < BENCH_LINES; i++) {
+		BenchPrintf(buf, "%08x\n", BenchMcr(seed));
+	}
+	return BENCH_LINES;
+}
+
+static size_t BenchGenerateRepeat(struct BenchBuffer *buf, uint32_t *seed)
+{
+	uint32_t set[BENCH_WORKING_SET];
+
+	for (size_t i = 0; i < BENCH_WORKING_SET; i++) {
+		set[i] = BenchMcr(seed);
+	}
+	for (size_t i = 0; i < BENCH_LINES; i++) {
+		BenchPrintf(buf, "%08x\n", set[BenchRandom(seed) % BENCH_WORKING_SET]);
+	}
+	return BENCH_LINES;
+}
+
+/**
+ * A listing in the format of "objdump -d": functions of ARM code with
+ * the usual mix of instructions, a few literal pool words and Thumb
+ * halfwords, and a coprocessor access every now and then.
+ */
+static size_t BenchGenerateObjdump(struct BenchBuffer *buf, uint32_t *seed)
+{
+	static const char *const insns[] = {
+		"mov\tr0, r1",
+		"ldr\tr3, [pc, #24]\t; 80008040 <func+0x40>",
+		"bl\t80010000 <memcpy>",
+		"str\tr2, [r4, #8]",
+		"cmp\tr0, #0",
+		"bne\t80008018 <func+0x18>",
+		"push\t{r4, r5, r6, lr}",
+		"pop\t{r4, r5, r6, pc}",
+	};
+	uint32_t addr = 0x80008000;
+
+	BenchPrintf(buf, "\nvmlinux:     file format elf32-littlearm\n\n\n"
+			"Disassembly of section .text:\n");
+	for (size_t i = 0; i < BENCH_LINES; i++, addr += 4) {
+		uint32_t r = BenchRandom(seed);
+		if (!(i % BENCH_FUNCTION_LINES)) {
+			BenchPrintf(buf, "\n%08x <func_%u>:\n", addr, (unsigned)(i / BENCH_FUNCTION_LINES));
+		}
+		if (!(r % BENCH_MCR_INTERVAL)) {
+			uint32_t opcode = BenchMcr(seed);
+			BenchPrintf(buf, "%8x:\t%08x \t%s\t15, %u, r%u, cr%u, cr%u, {%u}\n", addr, opcode,
+					Extract(Ldop, opcode) ? "mrc" : "mcr",
+					Extract(Op1, opcode), Extract(Rd, opcode), Extract(CRn, opcode),
+					Extract(CRm, opcode), Extract(Op2, opcode));
+		}
+		else if (!(r % 29)) {
+			BenchPrintf(buf, "%8x:\t%08x \t.word\t0x%08x\n", addr, r, r);
+		}
+		else if (!(r % 31)) {
+			BenchPrintf(buf, "%8x:\t%04x      \tbx\tlr\n", addr, r & 0xffff);
+		}
+		else {
+			BenchPrintf(buf, "%8x:\t%08x \t%s\n", addr, r, insns[(r >> 8) % ARRAY_SIZE(insns)]);
+		}
+	}
+	return BENCH_LINES;
+}
+
+/**
+ * Random bytes with a coprocessor access in one of the encodings every
+ * few KB. Counted in words.
+ */
+static size_t BenchGenerateRaw(struct BenchBuffer *buf, uint32_t *seed)
+{
+	BenchReserve(buf, BENCH_RAW_SIZE);
+	for (size_t i = 0; i < BENCH_RAW_SIZE; i += sizeof(uint32_t)) {
+		uint32_t word = BenchRandom(seed);
+		if (!(word % (BENCH_MCR_INTERVAL * 16))) {
+			word = BenchMcr(seed);
+			word = (word & 1) ? __builtin_bswap32(word) : word;
+		}
+		memcpy(buf->data + i, &word, sizeof(word));
+	}
+	buf->size = BENCH_RAW_SIZE;
+	return BENCH_RAW_SIZE / sizeof(uint32_t);
+}
+
+static void BenchRunLines(struct Output *out, const char *data, size_t size,
+		void (*decode)(struct Output *out, struct InputStream *in))
+{
+	struct InputStream in;
+
+	InputOpenMemory(&in, data, size);
+	decode(out, &in);
+	InputClose(&in);
+}
+
+static void BenchRunHexLines(struct Output *out, const char *data, size_t size)
+{
+	BenchRunLines(out, data, size, DecodeHexLines);
+}
+
+static void BenchRunObjdump(struct Output *out, const char *data, size_t size)
+{
+	BenchRunLines(out, data, size, AnnotateObjdumpLines);
+}
+
+static void BenchRunPeephole(struct Output *out, const char *data, size_t size)
+{
+	BenchRunLines(out, data, size, TrackObjdumpLines);
+}
+
+static void BenchRunRaw(struct Output *out, const char *data, size_t size)
+{
+	struct RawImage img = {
+		.data = (const uint8_t *)data,
+		.size = size,
+	};
+	ScanRawChunk(out, data, data + size, &img);
+}
+
+static const struct BenchCorpus BenchCorpora[] = {
+	{ "words", BenchGenerateWords, BenchRunHexLines },
+	{ "dense", BenchGenerateDense, BenchRunHexLines },
+	{ "repeat", BenchGenerateRepeat, BenchRunHexLines },
+	{ "objdump", BenchGenerateObjdump, BenchRunObjdump },
+	{ "peephole", BenchGenerateObjdump, BenchRunPeephole },
+	{ "raw", BenchGenerateRaw, BenchRunRaw },
+};
+
+static int CompareDoubles(const void *a, const void *b)
+{
+	double da = *(const double *)a;
+	double db = *(const double *)b;
+	return (da < db) ? -1 : (da > db);
+}
+
+/**
+ * Look up the ns/item of a corpus in a baseline file. Returns a negative
+ * value if it is not there.
+ */
+static double BenchBaseline(FILE *baseline, const char *corpus)
+{
+	char line[256];
+	char name[BENCH_MAX_CORPUS_NAME];
+	double ns;
+
+	if (!baseline) {
+		return -1;
+	}
+	rewind(baseline);
+	while (fgets(line, sizeof(line), baseline)) {
+		if ((line[0] != '#') && (sscanf(line, "%31s %*s %*s %lf", name, &ns) == 2)
+				&& !strcmp(name, corpus)) {
+			return ns;
+		}
+	}
+	return -1;
+}
+
+static bool RunBenchmarks(const char *baselinePath)
+{
+	FILE *baseline = NULL;
+	bool ok = true;
+
+	if (baselinePath && !(baseline = fopen(baselinePath, "r"))) {
+		perror(baselinePath);
+		return false;
+	}
+	int null = open("/dev/null", O_WRONLY);
+	if (null < 0) {
+		perror("/dev/null");
+		return false;
+	}
+
+	printf("# corpus\titems\tbytes\tns/item\titems/s\tMB/s\n");
+	for (size_t c = 0; c < ARRAY_SIZE(BenchCorpora); c++) {
+		const struct BenchCorpus *corpus = &BenchCorpora[c];
+		struct BenchBuffer buf = { NULL, 0, 0 };
+		uint32_t seed = 0x2545f491;
+		double runs[BENCH_RUNS];
+
+		size_t items = corpus->generate(&buf, &seed);
+		for (int i = 0; i < BENCH_WARMUP_RUNS + BENCH_RUNS; i++) {
+			struct Output out;
+			OutputInit(&out, null);
+			double start = Now();
+			corpus->run(&out, buf.data, buf.size);
+			OutputFlush(&out);
+			double seconds = Now() - start;
+			OutputFree(&out);
+			if (i >= BENCH_WARMUP_RUNS) {
+				runs[i - BENCH_WARMUP_RUNS] = seconds;
+			}
+		}
+		qsort(runs, BENCH_RUNS, sizeof(runs[0]), CompareDoubles);
+		double median = runs[BENCH_RUNS / 2];
+		double ns = median * 1e9 / items;
+
+		printf("%s\t%zu\t%zu\t%.2f\t%.0f\t%.1f\n", corpus->name, items, buf.size,
+				ns, items / median, buf.size / median * 1e-6);
+		fflush(stdout);
+
+		double base = BenchBaseline(baseline, corpus->name);
+		if (base > 0) {
+			double change = (ns / base - 1) * 100;
+			bool regression = (change > BENCH_TOLERANCE);
+			fprintf(stderr, "%s: %.2f ns/item, baseline %.2f (%+.1f%%)%s\n", corpus->name,
+					ns, base, change, regression ? " REGRESSION" : "");
+			ok = ok && !regression;
+		}
+		else if (baseline) {
+			fprintf(stderr, "%s: not in the baseline\n", corpus->name);
+		}
+		free(buf.data);
+	}
+
+	close(null);
+	if (baseline) {
+		fclose(baseline);
+	}
+	return ok;
+}
+
+/**
+ * Parse a comma-separated list of ISA revision names (e.g. "a9,r4").
+ * Returns 0 if any of the names is unknown.
+ */
+static uint32_t ParseIsaList(const char *list)
+{
+	uint32_t isaMask = 0;
+
+	while (*list) {
+		size_t len = strcspn(list, ",");
+		bool found = false;
+		for (size_t i = 0; i < ArmCoproIsaCount(); i++) {
+			const char *name = ArmCoproIsaName(i);
+			if ((strlen(name) == len) && !strncmp(name, list, len)) {
+				isaMask |= BIT(i);
+				found = true;
+			}
+		}
+		if (!found) {
+			return 0;
+		}
+		list += len;
+		if (*list == ',') {
+			list++;
+		}
+	}
+	return isaMask;
+}
+
+static void Usage(const char *argv0)
+{
+	fprintf(stderr, "Usage: %s [--isa=REV[,REV...]] [-j N] [--cache-stats] [--stats[=json]] [--no-cache] [--peephole] [--summary] [--columnar] [--incremental=FILE] [fulltest | stdin [FILE] | objdump [FILE] | elf FILE | raw FILE | serve SOCKET | bench [BASELINE]]\n", argv0);
+	fprintf(stderr, "  REV is one of:");
+	for (size_t i = 0; i < ArmCoproIsaCount(); i++) {
+		fprintf(stderr, " %s", ArmCoproIsaName(i));
+	}
+	fprintf(stderr, "\n  By default the variants for all ISA revisions are printed.\n");
+	fprintf(stderr, "  -j N decodes regular files and scans raw images with N threads (0: one per CPU).\n");
+	fprintf(stderr, "  --cache-stats prints the hits and misses of the annotation cache at exit.\n");
+	fprintf(stderr, "  --stats prints what was decoded and where the time went at exit, as text\n"
+			"    or with --stats=json as JSON.\n");
+	fprintf(stderr, "  --peephole follows register values in objdump and elf mode and decodes\n"
+			"    the bitfields of the values written to coprocessor registers.\n");
+	fprintf(stderr, "  --summary makes objdump and elf mode write a CSV summary of the accesses\n"
+			"    per register, direction and function instead of the annotated listing.\n");
+	fprintf(stderr, "  --columnar makes objdump and elf mode write the accesses as binary\n"
+			"    columns, one record per access (see summary.h for the layout).\n");
+	fprintf(stderr, "  --incremental=FILE keeps the --peephole annotations of each function of an\n"
+			"    objdump listing in FILE and only decodes the functions that changed since.\n"
+			"    It needs objdump mode with --peephole: plain annotations are made as fast\n"
+			"    as they are looked up.\n");
+	fprintf(stderr, "  fulltest checks the decoder on all 2^32 encodings, by default on all CPUs.\n");
+	fprintf(stderr, "  serve answers decode requests on the Unix socket SOCKET until interrupted.\n");
+	fprintf(stderr, "  bench measures the decoders, failing on regressions against BASELINE.\n");
+}
+
+int main(int argc, char **argv) {
+	uint32_t isaMask = ARMCOPRO_ISA_ALL;
+	const char *mode = NULL;
+	const char *path = NULL;
+	/* 0 until given: the full test uses all CPUs by default */
+	unsigned threads = 0;
+	const char *incrementalPath = NULL;
+
+	for (int i = 1; i < argc; i++) {
+		if (!strncmp(argv[i], "-j", 2)) {
+			const char *arg = argv[i][2] ? (argv[i] + 2) : argv[++i];
+			char *end = NULL;
+			long val = arg ? strtol(arg, &end, 10) : -1;
+			if (!arg || *end || (val < 0)) {
+				Usage(argv[0]);
+				exit(1);
+			}
+			threads = val ? (unsigned)val : ParallelDefaultThreads();
+		}
+		else if (!strcmp(argv[i], "--cache-stats")) {
+			atexit(PrintAnnotationCacheStats);
+		}
+		else if (!strcmp(argv[i], "--stats") || !strcmp(argv[i], "--stats=text")
+				|| !strcmp(argv[i], "--stats=json")) {
+#ifdef WITH_STATS
+			RunStatsFormat = strcmp(argv[i], "--stats=json") ? StatsText : StatsJson;
+			StatsEnable();
+			atexit(PrintRunStats);
+#else
+			fprintf(stderr, "%s: built without WITH_STATS\n", argv[i]);
+			exit(1);
+#endif
+		}
+		else if (!strcmp(argv[i], "--peephole")) {
+			PeepholeEnabled = true;
+		}
+		else if (!strcmp(argv[i], "--summary")) {
+			SummaryEnabled = true;
+		}
+		else if (!strcmp(argv[i], "--columnar")) {
+			ColumnarEnabled = true;
+		}
+		else if (!strncmp(argv[i], "--incremental=", 14) && argv[i][14]) {
+			incrementalPath = argv[i] + 14;
+		}
+		else if (!strcmp(argv[i], "--no-cache")) {
+			AnnotationCacheEnabled = false;
+		}
+		else if (!strncmp(argv[i], "--isa=", 6)) {
+			isaMask = ParseIsaList(argv[i] + 6);
+			if (!isaMask) {
+				fprintf(stderr, "Unknown ISA revision in '%s'\n", argv[i]);
+				Usage(argv[0]);
+				exit(1);
+			}
+		}
+		else if (!mode && (argv[i][0] != '-')) {
+			mode = argv[i];
+		}
+		else if (mode && !path) {
+			path = argv[i];
+		}
+		else {
+			Usage(argv[0]);
+			exit(1);
+		}
+	}
+
+	IsaMask = isaMask;
+
+	if ((SummaryEnabled || ColumnarEnabled)
+			&& (!mode || (strcmp(mode, "objdump") && strcmp(mode, "elf")))) {
+		fprintf(stderr, "%s: only objdump and elf modes can be summarized\n",
+				SummaryEnabled ? "--summary" : "--columnar");
+		exit(1);
+	}
+	if (incrementalPath && (!mode || strcmp(mode, "objdump") || !PeepholeEnabled
+				|| SummaryEnabled || ColumnarEnabled)) {
+		fprintf(stderr, "--incremental: only for objdump mode with --peephole\n");
+		exit(1);
+	}
+
+	struct Output out;
+	OutputInit(&out, STDOUT_FILENO);
+
+	if (path && strcmp(mode, "stdin") && strcmp(mode, "objdump") && strcmp(mode, "elf")
+			&& strcmp(mode, "raw") && strcmp(mode, "serve") && strcmp(mode, "bench")) {
+		Usage(argv[0]);
+		exit(1);
+	}
+
+	if (mode && (!strcmp(mode, "fulltest"))) {
+		exit(RunFullTest(threads ? threads : ParallelDefaultThreads()) ? 0 : 1);
+	}
+	if (mode && (!strcmp(mode, "stdin"))) {
+		RunStdinDecoder(&out, path, threads);
+		OutputFlush(&out);
+		exit(0);
+	}
+	if (mode && (!strcmp(mode, "objdump"))) {
+		if (SummaryEnabled || ColumnarEnabled) {
+			RunObjdumpSummary(&out, path);
+		}
+		else if (incrementalPath) {
+			RunIncrementalObjdump(&out, path, incrementalPath);
+		}
+		else {
+			RunObjdumpDecoder(&out, path, threads);
+		}
+		OutputFlush(&out);
+		exit(0);
+	}
+	if (mode && (!strcmp(mode, "elf"))) {
+		if (SummaryEnabled || ColumnarEnabled) {
+			RunElfSummary(&out, path);
+		}
+		else {
+			RunElfScanner(&out, path);
+		}
+		exit(0);
+	}
+	if (mode && (!strcmp(mode, "raw"))) {
+		RunRawScanner(&out, path, threads);
+		exit(0);
+	}
+	if (mode && (!strcmp(mode, "serve"))) {
+		exit(RunDecodeServer(path) ? 0 : 1);
+	}
+	if (mode && (!strcmp(mode, "bench"))) {
+		exit(RunBenchmarks(path) ? 0 : 1);
+	}
+	if (mode) {
+		Usage(argv[0]);
+		exit(1);
 	}
-	DemoSomeMcrs();
+	DemoSomeMcrs(&out);
+	OutputFlush(&out);
+	OutputFree(&out);
 }
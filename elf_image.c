@@ -0,0 +1,387 @@
+#define _GNU_SOURCE
+
+#include <elf.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "elf_image.h"
+
+#ifndef EF_ARM_BE8
+#define EF_ARM_BE8 0x00800000
+#endif
+
+struct MappingSymbol {
+	uint32_t offset;
+	enum ElfCodeKind kind;
+};
+
+static inline uint16_t ElfHalf(const struct ElfImage *img, uint16_t val)
+{
+	return img->bigEndian ? __builtin_bswap16(val) : val;
+}
+
+static inline uint32_t ElfWord(const struct ElfImage *img, uint32_t val)
+{
+	return img->bigEndian ? __builtin_bswap32(val) : val;
+}
+
+static inline bool InBounds(const struct ElfImage *img, uint64_t offset, uint64_t size)
+{
+	return (offset <= img->size) && (size <= img->size - offset);
+}
+
+static int CompareFunctions(const void *a, const void *b)
+{
+	const struct ElfFunction *fa = a;
+	const struct ElfFunction *fb = b;
+	if (fa->section != fb->section) {
+		return (fa->section < fb->section) ? -1 : 1;
+	}
+	return (fa->addr < fb->addr) ? -1 : (fa->addr > fb->addr);
+}
+
+static int CompareMappingSymbols(const void *a, const void *b)
+{
+	const struct MappingSymbol *ma = a;
+	const struct MappingSymbol *mb = b;
+	return (ma->offset < mb->offset) ? -1 : (ma->offset > mb->offset);
+}
+
+/**
+ * Mapping symbols are named "$a", "$t" or "$d", optionally followed by
+ * a '.' and an arbitrary suffix.
+ */
+static bool ParseMappingSymbol(const char *name, enum ElfCodeKind *kind)
+{
+	if ((name[0] != '$') || (name[1] == 0) || ((name[2] != 0) && (name[2] != '.'))) {
+		return false;
+	}
+	switch (name[1]) {
+	case 'a':
+		*kind = ElfCodeArm;
+		return true;
+	case 't':
+		*kind = ElfCodeThumb;
+		return true;
+	case 'd':
+		*kind = ElfCodeData;
+		return true;
+	default:
+		return false;
+	}
+}
+
+static bool AppendRegion(struct ElfImage *img, size_t *capacity, const struct ElfRegion *region)
+{
+	if (!region->size) {
+		return true;
+	}
+	if (img->numRegions == *capacity) {
+		size_t newCapacity = *capacity ? (*capacity * 2) : 16;
+		struct ElfRegion *regions = realloc(img->regions, newCapacity * sizeof(regions[0]));
+		if (!regions) {
+			return false;
+		}
+		img->regions = regions;
+		*capacity = newCapacity;
+	}
+	img->regions[img->numRegions++] = *region;
+	return true;
+}
+
+/**
+ * Cut an executable section into regions at its mapping symbols, which
+ * must be sorted by offset. Code before the first one is taken to be ARM.
+ */
+static bool AddSectionRegions(struct ElfImage *img, size_t *capacity, uint16_t section,
+		const Elf32_Shdr *shdr, const struct MappingSymbol *syms, size_t numSyms)
+{
+	uint32_t secAddr = ElfWord(img, shdr->sh_addr);
+	uint32_t secSize = ElfWord(img, shdr->sh_size);
+	const uint8_t *secData = img->data + ElfWord(img, shdr->sh_offset);
+	struct ElfRegion region = {
+		.section = section,
+		.kind = ElfCodeArm,
+		.addr = secAddr,
+		.data = secData,
+		.size = 0,
+	};
+	uint32_t start = 0;
+
+	for (size_t i = 0; i <= numSyms; i++) {
+		uint32_t end = (i < numSyms) ? syms[i].offset : secSize;
+		if (end > secSize) {
+			end = secSize;
+		}
+		if (end > start) {
+			region.addr = secAddr + start;
+			region.data = secData + start;
+			region.size = end - start;
+			if (!AppendRegion(img, capacity, &region)) {
+				return false;
+			}
+			start = end;
+		}
+		if (i < numSyms) {
+			region.kind = syms[i].kind;
+		}
+	}
+	return true;
+}
+
+static const char *IndexImage(struct ElfImage *img)
+{
+	const Elf32_Ehdr *ehdr = (const Elf32_Ehdr *)img->data;
+
+	if ((img->size < sizeof(*ehdr)) || memcmp(ehdr->e_ident, ELFMAG, SELFMAG)) {
+		return "not an ELF file";
+	}
+	if (ehdr->e_ident[EI_CLASS] != ELFCLASS32) {
+		return "not a 32-bit ELF file";
+	}
+	img->bigEndian = (ehdr->e_ident[EI_DATA] == ELFDATA2MSB);
+	if (ElfHalf(img, ehdr->e_machine) != EM_ARM) {
+		return "not an ARM ELF file";
+	}
+	img->codeBigEndian = img->bigEndian && !(ElfWord(img, ehdr->e_flags) & EF_ARM_BE8);
+
+	bool relocatable = (ElfHalf(img, ehdr->e_type) == ET_REL);
+	uint32_t shoff = ElfWord(img, ehdr->e_shoff);
+	size_t shnum = ElfHalf(img, ehdr->e_shnum);
+
+	if (!shoff) {
+		return "no section headers";
+	}
+	if (ElfHalf(img, ehdr->e_shentsize) != sizeof(Elf32_Shdr)) {
+		return "unexpected section header size";
+	}
+	if (!InBounds(img, shoff, sizeof(Elf32_Shdr))) {
+		return "truncated section headers";
+	}
+	const Elf32_Shdr *shdrs = (const Elf32_Shdr *)(img->data + shoff);
+	if (!shnum) {
+		/* More than SHN_LORESERVE sections, the count is in section 0 */
+		shnum = ElfWord(img, shdrs[0].sh_size);
+	}
+	if (!InBounds(img, shoff, (uint64_t)shnum * sizeof(Elf32_Shdr))) {
+		return "truncated section headers";
+	}
+
+	for (size_t i = 0; i < shnum; i++) {
+		uint32_t type = ElfWord(img, shdrs[i].sh_type);
+		if ((type != SHT_NULL) && (type != SHT_NOBITS)
+				&& !InBounds(img, ElfWord(img, shdrs[i].sh_offset), ElfWord(img, shdrs[i].sh_size))) {
+			return "section out of bounds";
+		}
+	}
+
+	/* Symbols: functions and mapping symbols */
+	const Elf32_Sym *syms = NULL;
+	size_t numSyms = 0;
+	const char *strtab = NULL;
+	for (size_t i = 0; i < shnum; i++) {
+		if (ElfWord(img, shdrs[i].sh_type) != SHT_SYMTAB) {
+			continue;
+		}
+		uint32_t link = ElfWord(img, shdrs[i].sh_link);
+		if ((link >= shnum) || (ElfWord(img, shdrs[link].sh_type) != SHT_STRTAB)) {
+			return "bad symbol string table";
+		}
+		uint32_t strSize = ElfWord(img, shdrs[link].sh_size);
+		strtab = (const char *)img->data + ElfWord(img, shdrs[link].sh_offset);
+		if (!strSize || strtab[strSize - 1]) {
+			return "unterminated symbol string table";
+		}
+		syms = (const Elf32_Sym *)(img->data + ElfWord(img, shdrs[i].sh_offset));
+		numSyms = ElfWord(img, shdrs[i].sh_size) / sizeof(Elf32_Sym);
+		for (size_t s = 0; s < numSyms; s++) {
+			if (ElfWord(img, syms[s].st_name) >= strSize) {
+				return "bad symbol name";
+			}
+		}
+		break;
+	}
+
+	struct MappingSymbol *mapping = calloc(numSyms + 1, sizeof(mapping[0]));
+	uint16_t *mappingSection = calloc(numSyms + 1, sizeof(mappingSection[0]));
+	img->functions = calloc(numSyms + 1, sizeof(img->functions[0]));
+	if (!mapping || !mappingSection || !img->functions) {
+		free(mapping);
+		free(mappingSection);
+		return "out of memory";
+	}
+
+	size_t numMapping = 0;
+	for (size_t s = 0; s < numSyms; s++) {
+		const char *name = strtab + ElfWord(img, syms[s].st_name);
+		uint16_t shndx = ElfHalf(img, syms[s].st_shndx);
+		uint32_t value = ElfWord(img, syms[s].st_value);
+		enum ElfCodeKind kind;
+
+		if ((shndx == SHN_UNDEF) || (shndx >= shnum)) {
+			continue;
+		}
+		if (ELF32_ST_TYPE(syms[s].st_info) == STT_FUNC) {
+			struct ElfFunction *func = &img->functions[img->numFunctions++];
+			func->section = shndx;
+			func->addr = value & ~1u;
+			func->size = ElfWord(img, syms[s].st_size);
+			func->name = name;
+		}
+		else if (ParseMappingSymbol(name, &kind)) {
+			uint32_t secAddr = relocatable ? 0 : ElfWord(img, shdrs[shndx].sh_addr);
+			mapping[numMapping].offset = value - secAddr;
+			mapping[numMapping].kind = kind;
+			mappingSection[numMapping] = shndx;
+			numMapping++;
+		}
+	}
+	qsort(img->functions, img->numFunctions, sizeof(img->functions[0]), CompareFunctions);
+
+	/* Executable sections, split at their mapping symbols */
+	size_t capacity = 0;
+	const char *error = NULL;
+	struct MappingSymbol *sectionMapping = calloc(numMapping + 1, sizeof(sectionMapping[0]));
+	if (!sectionMapping) {
+		error = "out of memory";
+	}
+	for (size_t i = 0; !error && (i < shnum); i++) {
+		if ((ElfWord(img, shdrs[i].sh_type) != SHT_PROGBITS)
+				|| !(ElfWord(img, shdrs[i].sh_flags) & SHF_EXECINSTR)) {
+			continue;
+		}
+
+		size_t count = 0;
+		for (size_t m = 0; m < numMapping; m++) {
+			if (mappingSection[m] == i) {
+				sectionMapping[count++] = mapping[m];
+			}
+		}
+		qsort(sectionMapping, count, sizeof(sectionMapping[0]), CompareMappingSymbols);
+
+		Elf32_Shdr shdr = shdrs[i];
+		if (relocatable) {
+			shdr.sh_addr = 0;
+		}
+		if (!AddSectionRegions(img, &capacity, i, &shdr, sectionMapping, count)) {
+			error = "out of memory";
+		}
+	}
+
+	free(sectionMapping);
+	free(mapping);
+	free(mappingSection);
+	return error;
+}
+
+bool ElfOpen(struct ElfImage *img, const char *path, const char **error)
+{
+	struct stat st;
+
+	memset(img, 0, sizeof(*img));
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		*error = "cannot open file";
+		return false;
+	}
+	if (fstat(fd, &st) || !S_ISREG(st.st_mode) || !st.st_size) {
+		close(fd);
+		*error = "not a regular file";
+		return false;
+	}
+	void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+	close(fd);
+	if (map == MAP_FAILED) {
+		*error = "cannot map file";
+		return false;
+	}
+	img->data = map;
+	img->size = st.st_size;
+
+	*error = IndexImage(img);
+	if (*error) {
+		ElfClose(img);
+		return false;
+	}
+	return true;
+}
+
+void ElfClose(struct ElfImage *img)
+{
+	if (img->data) {
+		munmap((void *)img->data, img->size);
+	}
+	free(img->regions);
+	free(img->functions);
+	memset(img, 0, sizeof(*img));
+}
+
+const struct ElfFunction *ElfFindFunction(const struct ElfImage *img,
+		uint16_t section, uint32_t addr)
+{
+	size_t lo = 0;
+	size_t hi = img->numFunctions;
+
+	/* Find the last function starting at or before addr */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct ElfFunction *func = &img->functions[mid];
+		if ((func->section < section)
+				|| ((func->section == section) && (func->addr <= addr))) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (!lo) {
+		return NULL;
+	}
+
+	const struct ElfFunction *func = &img->functions[lo - 1];
+	if (func->section != section) {
+		return NULL;
+	}
+	if (func->size && (addr - func->addr >= func->size)) {
+		return NULL;
+	}
+	return func;
+}
+
+bool ElfReadWord(const struct ElfImage *img, uint16_t section, uint32_t addr,
+		uint32_t *word)
+{
+	size_t lo = 0;
+	size_t hi = img->numRegions;
+
+	/* Find the last region starting at or before addr */
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		const struct ElfRegion *region = &img->regions[mid];
+		if ((region->section < section)
+				|| ((region->section == section) && (region->addr <= addr))) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if (!lo) {
+		return false;
+	}
+
+	const struct ElfRegion *region = &img->regions[lo - 1];
+	uint32_t offset = addr - region->addr;
+	if ((region->section != section) || (offset > region->size)
+			|| (region->size - offset < sizeof(*word))) {
+		return false;
+	}
+	memcpy(word, region->data + offset, sizeof(*word));
+	*word = ElfWord(img, *word);
+	return true;
+}
@@ -0,0 +1,74 @@
+#ifndef ELF_IMAGE_H
+#define ELF_IMAGE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * ARM ELF images
+ *****************************************************************************/
+
+/*
+ * A memory-mapped 32-bit ARM ELF file. The executable sections are cut
+ * into regions of ARM code, Thumb code and data according to the $a, $t
+ * and $d mapping symbols, and the function symbols are kept sorted by
+ * address to find the function containing an instruction.
+ */
+enum ElfCodeKind {
+	ElfCodeArm,
+	ElfCodeThumb,
+	ElfCodeData,
+};
+
+struct ElfRegion {
+	uint16_t section;
+	enum ElfCodeKind kind;
+	uint32_t addr;
+	const uint8_t *data;
+	size_t size;
+};
+
+struct ElfFunction {
+	uint16_t section;
+	uint32_t addr;
+	uint32_t size;
+	const char *name;
+};
+
+struct ElfImage {
+	const uint8_t *data;
+	size_t size;
+	/* The headers and data are big-endian */
+	bool bigEndian;
+	/* Instructions are stored big-endian too (BE32, not BE8) */
+	bool codeBigEndian;
+
+	struct ElfRegion *regions;
+	size_t numRegions;
+	struct ElfFunction *functions;
+	size_t numFunctions;
+};
+
+/**
+ * Map and index the ELF file at path. On failure, returns false and
+ * stores a description of the problem to *error.
+ */
+bool ElfOpen(struct ElfImage *img, const char *path, const char **error);
+void ElfClose(struct ElfImage *img);
+
+/**
+ * Find the function containing addr in the given section, or NULL.
+ */
+const struct ElfFunction *ElfFindFunction(const struct ElfImage *img,
+		uint16_t section, uint32_t addr);
+
+/**
+ * Read the data word at addr in the given section (e.g. a literal pool
+ * entry) in the byte order of the file. Returns false if the word does
+ * not lie entirely within one region of the section.
+ */
+bool ElfReadWord(const struct ElfImage *img, uint16_t section, uint32_t addr,
+		uint32_t *word);
+
+#endif /* ELF_IMAGE_H */
@@ -0,0 +1,753 @@
+/*
+ * gen_regdb: compile the register database (regdb.csv) into a C header.
+ *
+ * The header holds the registers as a struct-of-arrays sorted by key,
+ * all the strings interned into a single pool, and a perfect hash over
+ * the keys so that the decoder needs a single probe per instruction.
+ * For each selection of ISA revisions an index table lists the entries
+ * of every key that apply, so that the decoder never filters them.
+ * The bitfields of each register follow as another struct-of-arrays,
+ * grouped by register, which the registers index into.
+ *
+ * Usage: gen_regdb regdb.csv regdb.h
+ */
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#define ARRAY_SIZE(x) (sizeof(x) / sizeof(x[0]))
+
+enum {
+	MAX_LINE = 1024,
+	/* There is an index table for each of the 1 << MAX_ISAS selections */
+	MAX_ISAS = 8,
+	MAX_REGS = 4096,
+	MAX_FIELDS = 4096,
+	MAX_FIELDS_PER_REG = 255,
+	MAX_STRINGS = 65536,
+
+	/*
+	 * Key layout: Wide[18] Cp[17:14], then for MCR/MRC CRn[13:10]
+	 * Op1[9:7] CRm[6:3] Op2[2:0] and for MCRR/MRRC Op1[7:4] CRm[3:0]
+	 */
+	KEY_BITS = 19,
+	KEY_WIDE = 1 << 18,
+
+	MIN_HASH_BITS = 4,
+	MAX_HASH_BITS = 12,
+	HASH_ATTEMPTS = 1 << 20,
+};
+
+struct Isa {
+	char *name;
+	char *enumName;
+	char *description;
+};
+
+struct Reg {
+	unsigned line;
+	uint32_t key;
+	/* Accessed with MCRR/MRRC */
+	bool wide;
+	uint32_t isaMask;
+	char *name;
+	char *comment;
+	/* The range of its bitfields in Fields */
+	size_t firstField;
+	size_t numFields;
+};
+
+struct Field {
+	unsigned line;
+	uint32_t isaMask;
+	char *reg;
+	uint32_t msb;
+	uint32_t lsb;
+	char *name;
+};
+
+static const char *InputPath;
+/* The header is written here and renamed into place once it is complete */
+static char *TmpPath;
+
+static struct Isa Isas[MAX_ISAS];
+static size_t NumIsas;
+
+static struct Reg Regs[MAX_REGS];
+static size_t NumRegs;
+
+static struct Field Fields[MAX_FIELDS];
+static size_t NumFields;
+
+static char StringPool[MAX_STRINGS];
+static size_t StringPoolSize;
+
+static void Die(unsigned line, const char *msg, const char *arg)
+{
+	fprintf(stderr, "%s:%u: error: %s%s%s\n", InputPath, line, msg,
+			arg ? ": " : "", arg ? arg : "");
+	if (TmpPath) {
+		remove(TmpPath);
+	}
+	exit(1);
+}
+
+static char *Strdup(const char *s)
+{
+	char *ret = malloc(strlen(s) + 1);
+	if (!ret) {
+		Die(0, "out of memory", NULL);
+	}
+	return strcpy(ret, s);
+}
+
+/**
+ * Split off the next comma-separated field. If last is set, the field
+ * extends to the end of the line.
+ */
+static char *NextField(char **cursor, bool last, unsigned line)
+{
+	char *field = *cursor;
+	if (!field) {
+		Die(line, "missing field", NULL);
+	}
+	if (last) {
+		*cursor = NULL;
+		return field;
+	}
+	char *comma = strchr(field, ',');
+	if (comma) {
+		*comma = 0;
+		*cursor = comma + 1;
+	}
+	else {
+		*cursor = NULL;
+	}
+	return field;
+}
+
+static uint32_t ParseField(char **cursor, uint32_t max, unsigned line)
+{
+	char *field = NextField(cursor, false, line);
+	char *end = NULL;
+	unsigned long val = strtoul(field, &end, 0);
+	if ((end == field) || *end || (val > max)) {
+		Die(line, "bad numeric field", field);
+	}
+	return val;
+}
+
+static uint32_t ParseIsaMask(char *field, unsigned line)
+{
+	if (!strcmp(field, "*")) {
+		return 0xffffffff;
+	}
+
+	uint32_t isaMask = 0;
+	for (char *name = strtok(field, "|"); name; name = strtok(NULL, "|")) {
+		size_t i;
+		for (i = 0; i < NumIsas; i++) {
+			if (!strcmp(Isas[i].name, name)) {
+				break;
+			}
+		}
+		if (i == NumIsas) {
+			Die(line, "unknown ISA revision", name);
+		}
+		isaMask |= 1u << i;
+	}
+	return isaMask;
+}
+
+/**
+ * The coprocessors the decoder looks up: CP10/11, CP14 and CP15.
+ */
+static uint32_t ParseCoprocessor(char **cursor, unsigned line)
+{
+	uint32_t cp = ParseField(cursor, 15, line);
+	if ((cp != 10) && (cp != 11) && (cp != 14) && (cp != 15)) {
+		Die(line, "coprocessor not decoded", NULL);
+	}
+	return cp;
+}
+
+static struct Reg *AddReg(char **cursor, unsigned line)
+{
+	if (NumRegs == MAX_REGS) {
+		Die(line, "too many registers", NULL);
+	}
+	struct Reg *reg = &Regs[NumRegs++];
+	reg->line = line;
+	reg->isaMask = ParseIsaMask(NextField(cursor, false, line), line);
+	return reg;
+}
+
+static void ParseRegName(struct Reg *reg, char **cursor, unsigned line)
+{
+	reg->name = Strdup(NextField(cursor, false, line));
+	reg->comment = Strdup(NextField(cursor, true, line));
+	if (!*reg->name) {
+		Die(line, "empty register name", NULL);
+	}
+}
+
+static void ParseLine(char *buf, unsigned line)
+{
+	char *cursor = buf;
+	char *type = NextField(&cursor, false, line);
+
+	if (!strcmp(type, "isa")) {
+		if (NumIsas == MAX_ISAS) {
+			Die(line, "too many ISA revisions", NULL);
+		}
+		struct Isa *isa = &Isas[NumIsas++];
+		isa->name = Strdup(NextField(&cursor, false, line));
+		isa->enumName = Strdup(NextField(&cursor, false, line));
+		isa->description = Strdup(NextField(&cursor, true, line));
+	}
+	else if (!strcmp(type, "reg") || !strcmp(type, "cpreg")) {
+		struct Reg *reg = AddReg(&cursor, line);
+		uint32_t cp = strcmp(type, "reg") ? ParseCoprocessor(&cursor, line) : 15;
+		uint32_t crn = ParseField(&cursor, 15, line);
+		uint32_t op1 = ParseField(&cursor, 7, line);
+		uint32_t crm = ParseField(&cursor, 15, line);
+		uint32_t op2 = ParseField(&cursor, 7, line);
+		reg->key = (cp << 14) | (crn << 10) | (op1 << 7) | (crm << 3) | op2;
+		ParseRegName(reg, &cursor, line);
+	}
+	else if (!strcmp(type, "reg64")) {
+		struct Reg *reg = AddReg(&cursor, line);
+		uint32_t cp = ParseCoprocessor(&cursor, line);
+		uint32_t op1 = ParseField(&cursor, 15, line);
+		uint32_t crm = ParseField(&cursor, 15, line);
+		reg->key = KEY_WIDE | (cp << 14) | (op1 << 4) | crm;
+		reg->wide = true;
+		ParseRegName(reg, &cursor, line);
+	}
+	else if (!strcmp(type, "field")) {
+		if (NumFields == MAX_FIELDS) {
+			Die(line, "too many fields", NULL);
+		}
+		struct Field *field = &Fields[NumFields++];
+		field->line = line;
+		field->isaMask = ParseIsaMask(NextField(&cursor, false, line), line);
+		field->reg = Strdup(NextField(&cursor, false, line));
+		field->msb = ParseField(&cursor, 31, line);
+		field->lsb = ParseField(&cursor, 31, line);
+		field->name = Strdup(NextField(&cursor, true, line));
+		if (field->msb < field->lsb) {
+			Die(line, "field MSB below LSB", field->name);
+		}
+		if (!*field->name) {
+			Die(line, "empty field name", NULL);
+		}
+	}
+	else {
+		Die(line, "unknown record type", type);
+	}
+}
+
+static void ParseFile(FILE *in)
+{
+	char buf[MAX_LINE];
+	unsigned line = 0;
+
+	while (fgets(buf, sizeof(buf), in)) {
+		line++;
+		size_t len = strlen(buf);
+		if (len && (buf[len - 1] != '\n') && !feof(in)) {
+			Die(line, "line too long", NULL);
+		}
+		while (len && ((buf[len - 1] == '\n') || (buf[len - 1] == '\r'))) {
+			buf[--len] = 0;
+		}
+		if (!len || (buf[0] == '#')) {
+			continue;
+		}
+		ParseLine(buf, line);
+	}
+}
+
+/**
+ * Entries are sorted by key so that all the variants of an encoding form
+ * a contiguous run. The sort is stable to keep the order of the database.
+ */
+static int CompareRegs(const void *a, const void *b)
+{
+	const struct Reg *ra = a;
+	const struct Reg *rb = b;
+	if (ra->key != rb->key) {
+		return (ra->key < rb->key) ? -1 : 1;
+	}
+	return (ra->line < rb->line) ? -1 : (ra->line > rb->line);
+}
+
+static void CheckDuplicates(void)
+{
+	for (size_t i = 0; i < NumRegs; i++) {
+		for (size_t j = i + 1; (j < NumRegs) && (Regs[j].key == Regs[i].key); j++) {
+			if (Regs[i].isaMask & Regs[j].isaMask) {
+				char msg[256];
+				snprintf(msg, sizeof(msg), "'%s' has the same encoding as '%s' (line %u)",
+						Regs[j].name, Regs[i].name, Regs[i].line);
+				Die(Regs[j].line, "duplicate key", msg);
+			}
+		}
+	}
+}
+
+/**
+ * Fields are grouped by register name, each register in order of the
+ * bits and then of the database.
+ */
+static int CompareFields(const void *a, const void *b)
+{
+	const struct Field *fa = a;
+	const struct Field *fb = b;
+	int cmp = strcmp(fa->reg, fb->reg);
+	if (cmp) {
+		return cmp;
+	}
+	if (fa->lsb != fb->lsb) {
+		return (fa->lsb < fb->lsb) ? -1 : 1;
+	}
+	return (fa->line < fb->line) ? -1 : (fa->line > fb->line);
+}
+
+/**
+ * Attach the fields to the registers of that name, which must exist. The
+ * fields of a register must not overlap for the same ISA revision. They
+ * describe 32-bit values, so 64-bit registers of the same name do not
+ * get them.
+ */
+static void LinkFields(void)
+{
+	qsort(Fields, NumFields, sizeof(Fields[0]), CompareFields);
+
+	for (size_t i = 0; i < NumFields; ) {
+		size_t end = i + 1;
+		while ((end < NumFields) && !strcmp(Fields[end].reg, Fields[i].reg)) {
+			end++;
+		}
+		if (end - i > MAX_FIELDS_PER_REG) {
+			Die(Fields[i].line, "too many fields for register", Fields[i].reg);
+		}
+		for (size_t a = i; a < end; a++) {
+			for (size_t b = a + 1; b < end; b++) {
+				if ((Fields[a].isaMask & Fields[b].isaMask)
+						&& (Fields[b].lsb <= Fields[a].msb)) {
+					char msg[256];
+					snprintf(msg, sizeof(msg), "'%s' overlaps '%s' (line %u)",
+							Fields[b].name, Fields[a].name, Fields[a].line);
+					Die(Fields[b].line, "overlapping fields", msg);
+				}
+			}
+		}
+
+		bool found = false;
+		for (size_t r = 0; r < NumRegs; r++) {
+			if (!Regs[r].wide && !strcmp(Regs[r].name, Fields[i].reg)) {
+				Regs[r].firstField = i;
+				Regs[r].numFields = end - i;
+				found = true;
+			}
+		}
+		if (!found) {
+			Die(Fields[i].line, "field of an unknown register", Fields[i].reg);
+		}
+		i = end;
+	}
+}
+
+static bool FieldCollides(const struct Reg *reg, size_t i)
+{
+	for (size_t j = reg->firstField; j < reg->firstField + reg->numFields; j++) {
+		if ((j != i) && (Fields[j].lsb <= Fields[i].msb) && (Fields[i].lsb <= Fields[j].msb)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static size_t FieldTextLength(const struct Field *field)
+{
+	char digits[16];
+	uint32_t width = field->msb - field->lsb + 1;
+	uint32_t max = (width == 32) ? 0xffffffffu : ((1u << width) - 1);
+
+	return strlen(field->name) + 2 + snprintf(digits, sizeof(digits), "%u", max);
+}
+
+/**
+ * The room " NAME=VALUE" takes for each field of a register, with the
+ * value in decimal, when all revisions are selected. The fields that
+ * overlap on different revisions go in a " (REV:...)" group for each
+ * revision they are on.
+ */
+static size_t FieldsTextLength(const struct Reg *reg)
+{
+	size_t length = 0;
+
+	for (size_t i = reg->firstField; i < reg->firstField + reg->numFields; i++) {
+		if (!FieldCollides(reg, i)) {
+			length += FieldTextLength(&Fields[i]);
+		}
+	}
+	for (size_t r = 0; r < NumIsas; r++) {
+		size_t group = 0;
+		for (size_t i = reg->firstField; i < reg->firstField + reg->numFields; i++) {
+			if ((Fields[i].isaMask & (1u << r)) && FieldCollides(reg, i)) {
+				group += FieldTextLength(&Fields[i]);
+			}
+		}
+		if (group) {
+			length += strlen(" (:)") + strlen(Isas[r].name) + group;
+		}
+	}
+	return length;
+}
+
+/**
+ * Add a string to the pool, reusing an existing copy if there is one.
+ * Offset 0 is the empty string, which the decoder treats as NULL.
+ */
+static uint32_t InternString(const char *s)
+{
+	size_t len = strlen(s);
+	for (size_t off = 0; off < StringPoolSize; off += strlen(StringPool + off) + 1) {
+		if (!strcmp(StringPool + off, s)) {
+			return off;
+		}
+	}
+	if (StringPoolSize + len + 1 > 0xffff) {
+		Die(0, "string pool overflow", NULL);
+	}
+	uint32_t off = StringPoolSize;
+	memcpy(StringPool + off, s, len + 1);
+	StringPoolSize += len + 1;
+	return off;
+}
+
+static uint32_t HashSlot(uint32_t key, uint32_t mul, unsigned bits)
+{
+	return (uint32_t)(key * mul) >> (32 - bits);
+}
+
+/**
+ * Find a multiplier giving a collision-free multiplicative hash of the
+ * distinct keys into the smallest possible power-of-two table.
+ */
+static bool FindPerfectHash(uint32_t *mulOut, unsigned *bitsOut)
+{
+	static uint32_t owner[1 << MAX_HASH_BITS];
+	uint32_t seed = 0x2545f491;
+
+	for (unsigned bits = MIN_HASH_BITS; bits <= MAX_HASH_BITS; bits++) {
+		if ((1u << bits) < NumRegs) {
+			continue;
+		}
+		for (unsigned attempt = 0; attempt < HASH_ATTEMPTS; attempt++) {
+			seed ^= seed << 13;
+			seed ^= seed >> 17;
+			seed ^= seed << 5;
+			uint32_t mul = seed | 1;
+			bool ok = true;
+
+			memset(owner, 0xff, sizeof(owner));
+			for (size_t i = 0; ok && (i < NumRegs); i++) {
+				uint32_t slot = HashSlot(Regs[i].key, mul, bits);
+				if (owner[slot] == UINT32_MAX) {
+					owner[slot] = Regs[i].key;
+				}
+				else if (owner[slot] != Regs[i].key) {
+					ok = false;
+				}
+			}
+			if (ok) {
+				*mulOut = mul;
+				*bitsOut = bits;
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+/*
+ * The pool is emitted as characters rather than as one string literal,
+ * which C99 only guarantees up to 4095 bytes.
+ */
+static void EmitChars(FILE *out, const char *s, size_t len)
+{
+	for (size_t i = 0; i < len; i++) {
+		if ((s[i] == '\'') || (s[i] == '\\')) {
+			fprintf(out, "'\\%c',", s[i]);
+		}
+		else if (!s[i]) {
+			fputs("0,", out);
+		}
+		else {
+			fprintf(out, "'%c',", s[i]);
+		}
+	}
+}
+
+static void EmitHeader(FILE *out)
+{
+	uint32_t mul = 0;
+	unsigned bits = 0;
+	if (!FindPerfectHash(&mul, &bits)) {
+		Die(0, "failed to find a perfect hash", NULL);
+	}
+
+	uint32_t nameOffsets[MAX_REGS];
+	uint32_t commentOffsets[MAX_REGS];
+	size_t maxNameLength = 0;
+	size_t maxCommentLength = 0;
+	size_t maxVariants = 0;
+	size_t variants = 0;
+	size_t maxFieldsText = 0;
+
+	InternString("");
+	for (size_t i = 0; i < NumRegs; i++) {
+		nameOffsets[i] = InternString(Regs[i].name);
+		commentOffsets[i] = InternString(Regs[i].comment);
+
+		if (strlen(Regs[i].name) > maxNameLength) {
+			maxNameLength = strlen(Regs[i].name);
+		}
+		if (strlen(Regs[i].comment) > maxCommentLength) {
+			maxCommentLength = strlen(Regs[i].comment);
+		}
+		variants = (i && (Regs[i - 1].key == Regs[i].key)) ? variants + 1 : 1;
+		if (variants > maxVariants) {
+			maxVariants = variants;
+		}
+		if (FieldsTextLength(&Regs[i]) > maxFieldsText) {
+			maxFieldsText = FieldsTextLength(&Regs[i]);
+		}
+	}
+
+	uint32_t fieldNameOffsets[MAX_FIELDS];
+	for (size_t i = 0; i < NumFields; i++) {
+		fieldNameOffsets[i] = InternString(Fields[i].name);
+	}
+
+	fprintf(out, "/* Generated by gen_regdb from %s. Do not edit. */\n", InputPath);
+	fprintf(out, "#ifndef REGDB_H\n#define REGDB_H\n\n");
+	fprintf(out, "#include <stdint.h>\n\n");
+
+	fprintf(out, "enum ArmIsaRevision {\n");
+	for (size_t i = 0; i < NumIsas; i++) {
+		fprintf(out, "\tArmIsa%s = 1u << %zu, /* %s */\n",
+				Isas[i].enumName, i, Isas[i].description);
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "enum {\n");
+	fprintf(out, "\tREGDB_ISA_COUNT = %zu,\n", NumIsas);
+	fprintf(out, "\tREGDB_COUNT = %zu,\n", NumRegs);
+	fprintf(out, "\tREGDB_KEY_BITS = %u,\n", KEY_BITS);
+	fprintf(out, "\tREGDB_HASH_BITS = %u,\n", bits);
+	fprintf(out, "\tREGDB_HASH_SIZE = 1 << REGDB_HASH_BITS,\n");
+	fprintf(out, "\tREGDB_MAX_NAME_LENGTH = %zu,\n", maxNameLength);
+	fprintf(out, "\tREGDB_MAX_COMMENT_LENGTH = %zu,\n", maxCommentLength);
+	fprintf(out, "\tREGDB_MAX_VARIANTS = %zu,\n", maxVariants);
+	fprintf(out, "\tREGDB_FIELD_COUNT = %zu,\n", NumFields);
+	fprintf(out, "\tREGDB_MAX_FIELDS_TEXT = %zu,\n", maxFieldsText);
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "#define REGDB_KEY_WIDE 0x%xu\n\n", KEY_WIDE);
+	fprintf(out, "#define REGDB_KEY(cp, crn, op1, crm, op2) \\\n"
+			"\t(((uint32_t)(cp) << 14) | ((crn) << 10) | ((op1) << 7) | ((crm) << 3) | (op2))\n\n");
+	fprintf(out, "#define REGDB_KEY64(cp, op1, crm) \\\n"
+			"\t(REGDB_KEY_WIDE | ((uint32_t)(cp) << 14) | ((op1) << 4) | (crm))\n\n");
+	fprintf(out, "#define REGDB_HASH_MUL 0x%08xu\n\n", mul);
+	fprintf(out, "static inline uint32_t RegDbHashSlot(uint32_t key)\n{\n"
+			"\treturn (uint32_t)(key * REGDB_HASH_MUL) >> (32 - REGDB_HASH_BITS);\n}\n\n");
+
+	fprintf(out, "static const char *const RegDbIsaNames[REGDB_ISA_COUNT] = {\n");
+	for (size_t i = 0; i < NumIsas; i++) {
+		fprintf(out, "\t\"%s\",\n", Isas[i].name);
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const uint32_t RegDbKey[REGDB_COUNT] = {");
+	for (size_t i = 0; i < NumRegs; i++) {
+		fprintf(out, "%s0x%05x,", (i % 8) ? " " : "\n\t", Regs[i].key);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const uint32_t RegDbIsa[REGDB_COUNT] = {");
+	for (size_t i = 0; i < NumRegs; i++) {
+		fprintf(out, "%s0x%08x,", (i % 8) ? " " : "\n\t", Regs[i].isaMask);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const uint16_t RegDbName[REGDB_COUNT] = {");
+	for (size_t i = 0; i < NumRegs; i++) {
+		fprintf(out, "%s%u,", (i % 8) ? " " : "\n\t", nameOffsets[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const uint16_t RegDbComment[REGDB_COUNT] = {");
+	for (size_t i = 0; i < NumRegs; i++) {
+		fprintf(out, "%s%u,", (i % 8) ? " " : "\n\t", commentOffsets[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const uint16_t RegDbFieldFirst[REGDB_COUNT] = {");
+	for (size_t i = 0; i < NumRegs; i++) {
+		fprintf(out, "%s%zu,", (i % 8) ? " " : "\n\t", Regs[i].firstField);
+	}
+	fprintf(out, "\n};\n\n");
+
+	fprintf(out, "static const uint8_t RegDbFieldCount[REGDB_COUNT] = {");
+	for (size_t i = 0; i < NumRegs; i++) {
+		fprintf(out, "%s%zu,", (i % 8) ? " " : "\n\t", Regs[i].numFields);
+	}
+	fprintf(out, "\n};\n\n");
+
+	/* The field arrays have a trailing zero entry in case there are none */
+	fprintf(out, "static const uint32_t RegDbFieldIsa[REGDB_FIELD_COUNT + 1] = {");
+	for (size_t i = 0; i < NumFields; i++) {
+		fprintf(out, "%s0x%08x,", (i % 8) ? " " : "\n\t", Fields[i].isaMask);
+	}
+	fprintf(out, "\n\t0,\n};\n\n");
+
+	fprintf(out, "static const uint8_t RegDbFieldLsb[REGDB_FIELD_COUNT + 1] = {");
+	for (size_t i = 0; i < NumFields; i++) {
+		fprintf(out, "%s%u,", (i % 8) ? " " : "\n\t", Fields[i].lsb);
+	}
+	fprintf(out, "\n\t0,\n};\n\n");
+
+	fprintf(out, "static const uint8_t RegDbFieldWidth[REGDB_FIELD_COUNT + 1] = {");
+	for (size_t i = 0; i < NumFields; i++) {
+		fprintf(out, "%s%u,", (i % 8) ? " " : "\n\t", Fields[i].msb - Fields[i].lsb + 1);
+	}
+	fprintf(out, "\n\t0,\n};\n\n");
+
+	fprintf(out, "static const uint16_t RegDbFieldName[REGDB_FIELD_COUNT + 1] = {");
+	for (size_t i = 0; i < NumFields; i++) {
+		fprintf(out, "%s%u,", (i % 8) ? " " : "\n\t", fieldNameOffsets[i]);
+	}
+	fprintf(out, "\n\t0,\n};\n\n");
+
+	fprintf(out, "static const char RegDbStrings[%zu] = {", StringPoolSize);
+	for (size_t off = 0; off < StringPoolSize; ) {
+		size_t len = strlen(StringPool + off) + 1;
+		fprintf(out, "\n\t");
+		EmitChars(out, StringPool + off, len);
+		off += len;
+	}
+	fprintf(out, "\n};\n\n");
+
+	/* Slot value is the number of the key, in key order, plus one */
+	uint16_t hash[1 << MAX_HASH_BITS];
+	size_t keyNumbers[MAX_REGS];
+	size_t numKeys = 0;
+	memset(hash, 0, sizeof(hash));
+	for (size_t i = 0; i < NumRegs; i++) {
+		if (i && (Regs[i - 1].key != Regs[i].key)) {
+			numKeys++;
+		}
+		keyNumbers[i] = numKeys;
+		hash[HashSlot(Regs[i].key, mul, bits)] = numKeys + 1;
+	}
+	numKeys++;
+	fprintf(out, "static const uint16_t RegDbHash[REGDB_HASH_SIZE] = {");
+	for (size_t i = 0; i < (1u << bits); i++) {
+		fprintf(out, "%s%u,", (i % 16) ? " " : "\n\t", hash[i]);
+	}
+	fprintf(out, "\n};\n\n");
+
+	/*
+	 * The entries of key k that apply to the selection s are
+	 * RegDbSelected[RegDbSelect[s][k]] up to RegDbSelected[RegDbSelect[s][k + 1]],
+	 * in the order of the database.
+	 */
+	size_t numSelections = (size_t)1 << NumIsas;
+	uint16_t *selected = malloc(numSelections * NumRegs * sizeof(*selected));
+	size_t numSelected = 0;
+	if (!selected) {
+		Die(0, "out of memory", NULL);
+	}
+	fprintf(out, "enum {\n");
+	fprintf(out, "\tREGDB_KEY_COUNT = %zu,\n", numKeys);
+	fprintf(out, "\tREGDB_SELECTIONS = 1 << REGDB_ISA_COUNT,\n");
+	fprintf(out, "};\n\n");
+	fprintf(out, "static const uint16_t RegDbSelect[REGDB_SELECTIONS][REGDB_KEY_COUNT + 1] = {\n");
+	for (size_t sel = 0; sel < numSelections; sel++) {
+		fprintf(out, "\t{");
+		for (size_t i = 0, k = 0; k <= numKeys; k++) {
+			if (numSelected > 0xffff) {
+				Die(0, "too many entries in the selection tables", NULL);
+			}
+			fprintf(out, "%s%zu,", (k % 16) ? " " : "\n\t\t", numSelected);
+			for (; (i < NumRegs) && (keyNumbers[i] == k); i++) {
+				if (Regs[i].isaMask & sel) {
+					selected[numSelected++] = i;
+				}
+			}
+		}
+		fprintf(out, "\n\t},\n");
+	}
+	fprintf(out, "};\n\n");
+
+	fprintf(out, "static const uint16_t RegDbSelected[%zu] = {", numSelected + 1);
+	for (size_t i = 0; i < numSelected; i++) {
+		fprintf(out, "%s%u,", (i % 16) ? " " : "\n\t", selected[i]);
+	}
+	fprintf(out, "\n\t0,\n};\n\n");
+	free(selected);
+
+	fprintf(out, "#endif /* REGDB_H */\n");
+}
+
+int main(int argc, char **argv)
+{
+	if (argc != 3) {
+		fprintf(stderr, "Usage: %s regdb.csv regdb.h\n", argv[0]);
+		return 1;
+	}
+	InputPath = argv[1];
+
+	FILE *in = fopen(argv[1], "r");
+	if (!in) {
+		perror(argv[1]);
+		return 1;
+	}
+	ParseFile(in);
+	fclose(in);
+
+	if (!NumRegs) {
+		Die(0, "no registers defined", NULL);
+	}
+	qsort(Regs, NumRegs, sizeof(Regs[0]), CompareRegs);
+	CheckDuplicates();
+	LinkFields();
+
+	/*
+	 * A failure half-way must not leave a header behind that make would
+	 * take as up to date.
+	 */
+	TmpPath = malloc(strlen(argv[2]) + sizeof(".tmp"));
+	if (!TmpPath) {
+		Die(0, "out of memory", NULL);
+	}
+	strcat(strcpy(TmpPath, argv[2]), ".tmp");
+	FILE *out = fopen(TmpPath, "w");
+	if (!out) {
+		perror(TmpPath);
+		return 1;
+	}
+	EmitHeader(out);
+	if (fclose(out) || rename(TmpPath, argv[2])) {
+		perror(argv[2]);
+		remove(TmpPath);
+		return 1;
+	}
+	return 0;
+}
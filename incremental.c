@@ -0,0 +1,300 @@
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "incremental.h"
+
+enum {
+	INCREMENTAL_VERSION = 3,
+	INCREMENTAL_MIN_ENTRIES = 256,
+	INCREMENTAL_MIN_BLOB = 64 << 10,
+};
+
+static const char IncrementalMagic[8] = "ARMCOPRO";
+
+struct IncrementalHeader {
+	char magic[8];
+	uint32_t version;
+	uint32_t numEntries;
+	uint64_t options;
+	uint64_t blobSize;
+};
+
+static void *ReallocOrDie(void *ptr, size_t size)
+{
+	void *ret = realloc(ptr, size);
+	if (!ret) {
+		perror("realloc");
+		exit(1);
+	}
+	return ret;
+}
+
+/**
+ * Use the mapped file if it is complete and made with the same options,
+ * otherwise start from an empty cache.
+ */
+static bool CheckCacheFile(struct IncrementalCache *cache)
+{
+	struct IncrementalHeader header;
+
+	if (cache->mapSize < sizeof(header)) {
+		return false;
+	}
+	memcpy(&header, cache->map, sizeof(header));
+	if (memcmp(header.magic, IncrementalMagic, sizeof(header.magic))
+			|| (header.version != INCREMENTAL_VERSION)
+			|| (header.options != cache->options)) {
+		return false;
+	}
+	size_t entriesSize = (size_t)header.numEntries * sizeof(struct IncrementalEntry);
+	if ((cache->mapSize - sizeof(header) < entriesSize)
+			|| (cache->mapSize - sizeof(header) - entriesSize != header.blobSize)) {
+		return false;
+	}
+	cache->oldEntries = (const struct IncrementalEntry *)
+		((const char *)cache->map + sizeof(header));
+	cache->numOldEntries = header.numEntries;
+	cache->oldBlob = (const char *)cache->oldEntries + entriesSize;
+	return true;
+}
+
+void IncrementalOpen(struct IncrementalCache *cache, const char *path, uint64_t options)
+{
+	struct stat st;
+
+	memset(cache, 0, sizeof(*cache));
+	cache->path = path;
+	cache->options = options;
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return;
+	}
+	if (!fstat(fd, &st) && S_ISREG(st.st_mode) && st.st_size) {
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			cache->map = map;
+			cache->mapSize = st.st_size;
+		}
+	}
+	close(fd);
+
+	if (cache->map && !CheckCacheFile(cache)) {
+		fprintf(stderr, "%s: not a cache for these options, starting afresh\n", path);
+		cache->numOldEntries = 0;
+	}
+}
+
+static void AddEntry(struct IncrementalCache *cache, const struct IncrementalEntry *entry,
+		bool fromOld)
+{
+	if (cache->numEntries == cache->maxEntries) {
+		cache->maxEntries = cache->maxEntries ? (2 * cache->maxEntries) : INCREMENTAL_MIN_ENTRIES;
+		cache->entries = ReallocOrDie(cache->entries,
+				cache->maxEntries * sizeof(cache->entries[0]));
+		cache->fromOld = ReallocOrDie(cache->fromOld,
+				cache->maxEntries * sizeof(cache->fromOld[0]));
+	}
+	cache->entries[cache->numEntries] = *entry;
+	cache->fromOld[cache->numEntries] = fromOld;
+	cache->numEntries++;
+}
+
+bool IncrementalLookup(struct IncrementalCache *cache, uint64_t hash, uint32_t addr,
+		const char **records, size_t *length)
+{
+	size_t lo = 0;
+	size_t hi = cache->numOldEntries;
+
+	while (lo < hi) {
+		size_t mid = lo + (hi - lo) / 2;
+		if (cache->oldEntries[mid].hash < hash) {
+			lo = mid + 1;
+		}
+		else {
+			hi = mid;
+		}
+	}
+	if ((lo == cache->numOldEntries) || (cache->oldEntries[lo].hash != hash)) {
+		return false;
+	}
+
+	struct IncrementalEntry entry;
+	memcpy(&entry, &cache->oldEntries[lo], sizeof(entry));
+	const struct IncrementalHeader *header = cache->map;
+	if (((uint64_t)entry.offset + entry.length > header->blobSize)
+			|| ((entry.flags & INCREMENTAL_POSITION) && (entry.addr != addr))) {
+		return false;
+	}
+	*records = cache->oldBlob + entry.offset;
+	*length = entry.length;
+	AddEntry(cache, &entry, true);
+	return true;
+}
+
+void IncrementalBegin(struct IncrementalCache *cache)
+{
+	cache->entryStart = cache->blobSize;
+}
+
+char *IncrementalReserve(struct IncrementalCache *cache, uint32_t index, size_t length)
+{
+	uint32_t header[2] = { index, (uint32_t)length };
+	size_t size = sizeof(header) + ((length + 3) & ~(size_t)3);
+
+	if (cache->blobSize + size > cache->blobCapacity) {
+		size_t capacity = cache->blobCapacity ? cache->blobCapacity : INCREMENTAL_MIN_BLOB;
+		while (capacity < cache->blobSize + size) {
+			capacity *= 2;
+		}
+		cache->blob = ReallocOrDie(cache->blob, capacity);
+		cache->blobCapacity = capacity;
+	}
+	char *p = cache->blob + cache->blobSize;
+	memcpy(p, header, sizeof(header));
+	memset(p + sizeof(header) + length, 0, size - sizeof(header) - length);
+	cache->blobSize += size;
+	return p + sizeof(header);
+}
+
+void IncrementalEnd(struct IncrementalCache *cache, bool keep, uint64_t hash,
+		uint32_t addr, uint32_t flags)
+{
+	if (!keep || (cache->blobSize - cache->entryStart > UINT32_MAX)) {
+		cache->blobSize = cache->entryStart;
+		return;
+	}
+	struct IncrementalEntry entry = {
+		.hash = hash,
+		.addr = addr,
+		.flags = flags,
+		.offset = (uint32_t)cache->entryStart,
+		.length = (uint32_t)(cache->blobSize - cache->entryStart),
+	};
+	AddEntry(cache, &entry, false);
+}
+
+/******************************************************************************
+ * Saving
+ *****************************************************************************/
+
+struct SortKey {
+	uint64_t hash;
+	size_t index;
+};
+
+/* By hash, and in the order of the run for the same hash */
+static int CompareSortKeys(const void *a, const void *b)
+{
+	const struct SortKey *x = a;
+	const struct SortKey *y = b;
+
+	if (x->hash != y->hash) {
+		return (x->hash > y->hash) ? 1 : -1;
+	}
+	return (x->index > y->index) - (x->index < y->index);
+}
+
+static bool WriteAll(FILE *file, const void *data, size_t size)
+{
+	return !size || (fwrite(data, size, 1, file) == 1);
+}
+
+bool IncrementalSave(struct IncrementalCache *cache)
+{
+	struct SortKey *order = ReallocOrDie(NULL, (cache->numEntries + 1) * sizeof(*order));
+	size_t numEntries = 0;
+	uint64_t blobSize = 0;
+	bool ok = true;
+
+	for (size_t i = 0; i < cache->numEntries; i++) {
+		order[i].hash = cache->entries[i].hash;
+		order[i].index = i;
+	}
+	qsort(order, cache->numEntries, sizeof(*order), CompareSortKeys);
+
+	/* The same code may come up several times in a run */
+	for (size_t i = 0; i < cache->numEntries; i++) {
+		if (!numEntries || (order[i].hash != order[numEntries - 1].hash)) {
+			order[numEntries++] = order[i];
+			blobSize += cache->entries[order[i].index].length;
+		}
+	}
+	/* Nothing new and nothing gone: the file would come out the same */
+	bool unchanged = (numEntries == cache->numOldEntries);
+	for (size_t i = 0; unchanged && (i < numEntries); i++) {
+		unchanged = cache->fromOld[order[i].index];
+	}
+	if (unchanged) {
+		free(order);
+		return true;
+	}
+	if (blobSize > UINT32_MAX) {
+		fprintf(stderr, "%s: cache too large, not saved\n", cache->path);
+		free(order);
+		return false;
+	}
+
+	size_t pathLength = strlen(cache->path);
+	char *tmpPath = ReallocOrDie(NULL, pathLength + sizeof(".tmp"));
+	memcpy(tmpPath, cache->path, pathLength);
+	memcpy(tmpPath + pathLength, ".tmp", sizeof(".tmp"));
+
+	FILE *file = fopen(tmpPath, "wb");
+	if (!file) {
+		perror(tmpPath);
+		free(tmpPath);
+		free(order);
+		return false;
+	}
+
+	struct IncrementalHeader header = {
+		.version = INCREMENTAL_VERSION,
+		.numEntries = (uint32_t)numEntries,
+		.options = cache->options,
+		.blobSize = blobSize,
+	};
+	memcpy(header.magic, IncrementalMagic, sizeof(header.magic));
+	ok = WriteAll(file, &header, sizeof(header));
+
+	uint32_t offset = 0;
+	for (size_t i = 0; ok && (i < numEntries); i++) {
+		struct IncrementalEntry entry = cache->entries[order[i].index];
+		entry.offset = offset;
+		offset += entry.length;
+		ok = WriteAll(file, &entry, sizeof(entry));
+	}
+	for (size_t i = 0; ok && (i < numEntries); i++) {
+		const struct IncrementalEntry *entry = &cache->entries[order[i].index];
+		const char *base = cache->fromOld[order[i].index] ? cache->oldBlob : cache->blob;
+		ok = WriteAll(file, base + entry->offset, entry->length);
+	}
+
+	ok = !fclose(file) && ok;
+	if (ok && rename(tmpPath, cache->path)) {
+		ok = false;
+	}
+	if (!ok) {
+		perror(cache->path);
+		unlink(tmpPath);
+	}
+	free(tmpPath);
+	free(order);
+	return ok;
+}
+
+void IncrementalClose(struct IncrementalCache *cache)
+{
+	if (cache->map) {
+		munmap(cache->map, cache->mapSize);
+	}
+	free(cache->entries);
+	free(cache->fromOld);
+	free(cache->blob);
+	memset(cache, 0, sizeof(*cache));
+}
@@ -0,0 +1,124 @@
+#ifndef INCREMENTAL_H
+#define INCREMENTAL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/******************************************************************************
+ * On-disk cache of annotations for incremental runs
+ *****************************************************************************/
+
+/*
+ * The cache maps the hash of a piece of code (e.g. the opcodes of a
+ * function) to the annotations printed for it, as records of the index
+ * of the access an annotation follows and its text. The file of the last
+ * run is mapped and searched by hash; the entries used or added in this
+ * run are written to a new file that replaces it, so entries for code
+ * that went away are dropped.
+ *
+ * File layout, in host byte order:
+ *   header:  magic, version, options, number of entries, size of the blob
+ *   entries: sorted by hash
+ *   blob:    records of { index, length, text padded to 4 bytes }
+ */
+enum {
+	/* The annotations depend on the address of the code too */
+	INCREMENTAL_POSITION = 1,
+};
+
+struct IncrementalEntry {
+	uint64_t hash;
+	/* The address of the code, for INCREMENTAL_POSITION */
+	uint32_t addr;
+	uint32_t flags;
+	/* Where the records are in the blob */
+	uint32_t offset;
+	uint32_t length;
+};
+
+struct IncrementalCache {
+	const char *path;
+	/* Whatever else the annotations depend on, e.g. the ISA selection */
+	uint64_t options;
+
+	/* The file of the last run */
+	void *map;
+	size_t mapSize;
+	const struct IncrementalEntry *oldEntries;
+	size_t numOldEntries;
+	const char *oldBlob;
+
+	/* The entries of this run; in the old blob if they come from there */
+	struct IncrementalEntry *entries;
+	bool *fromOld;
+	size_t numEntries;
+	size_t maxEntries;
+	char *blob;
+	size_t blobSize;
+	size_t blobCapacity;
+	/* Blob size when the current new entry was started */
+	size_t entryStart;
+};
+
+/**
+ * Map the cache file at path, if there is a valid one made with the same
+ * options. A missing or unusable file is treated as empty.
+ */
+void IncrementalOpen(struct IncrementalCache *cache, const char *path, uint64_t options);
+
+/**
+ * Find the records for hash, which must be for addr if they depend on the
+ * address. The records stay valid until IncrementalClose.
+ */
+bool IncrementalLookup(struct IncrementalCache *cache, uint64_t hash, uint32_t addr,
+		const char **records, size_t *length);
+
+/**
+ * Add a new entry: IncrementalBegin, then IncrementalReserve for each
+ * annotation, then IncrementalEnd to keep or drop it.
+ */
+void IncrementalBegin(struct IncrementalCache *cache);
+
+/**
+ * Get room for the text of the annotation after the access at index. It
+ * is only valid until the next call.
+ */
+char *IncrementalReserve(struct IncrementalCache *cache, uint32_t index, size_t length);
+void IncrementalEnd(struct IncrementalCache *cache, bool keep, uint64_t hash,
+		uint32_t addr, uint32_t flags);
+
+/**
+ * Replace the cache file with the entries of this run, unless they are
+ * the same as in it. Returns false if it cannot be written.
+ */
+bool IncrementalSave(struct IncrementalCache *cache);
+void IncrementalClose(struct IncrementalCache *cache);
+
+/**
+ * Take the first record from records[0..*length). Returns false at the
+ * end.
+ */
+static inline bool IncrementalNextRecord(const char **records, size_t *length,
+		uint32_t *index, const char **text, uint32_t *textLength)
+{
+	uint32_t header[2];
+
+	if (*length < sizeof(header)) {
+		return false;
+	}
+	memcpy(header, *records, sizeof(header));
+	size_t size = sizeof(header) + (((size_t)header[1] + 3) & ~(size_t)3);
+	if (size > *length) {
+		return false;
+	}
+	*index = header[0];
+	*text = *records + sizeof(header);
+	*textLength = header[1];
+	*records += size;
+	*length -= size;
+	return true;
+}
+
+#endif /* INCREMENTAL_H */
@@ -0,0 +1,245 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "input.h"
+#include "stats.h"
+
+enum {
+	INPUT_BLOCK_SIZE = 1 << 20,
+};
+
+/******************************************************************************
+ * Newline and colon search
+ *****************************************************************************/
+
+#if defined(__AVX2__)
+typedef __m256i ScanVector;
+#define SCAN_WIDTH 32
+#define ScanLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define ScanSplat(c) _mm256_set1_epi8(c)
+#define ScanMatch(v, c) ((uint32_t)_mm256_movemask_epi8(_mm256_cmpeq_epi8((v), (c))))
+#elif defined(__SSE2__)
+typedef __m128i ScanVector;
+#define SCAN_WIDTH 16
+#define ScanLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define ScanSplat(c) _mm_set1_epi8(c)
+#define ScanMatch(v, c) ((uint32_t)_mm_movemask_epi8(_mm_cmpeq_epi8((v), (c))))
+#endif
+
+const char *ScanLine(const char *p, const char *end, const char **colon)
+{
+	*colon = NULL;
+
+#ifdef SCAN_WIDTH
+	const ScanVector newlines = ScanSplat('\n');
+	const ScanVector colons = ScanSplat(':');
+
+	for (; p + SCAN_WIDTH <= end; p += SCAN_WIDTH) {
+		ScanVector v = ScanLoad(p);
+		uint32_t nlMask = ScanMatch(v, newlines);
+		uint32_t colonMask = *colon ? 0 : ScanMatch(v, colons);
+
+		if (nlMask) {
+			/* Only the colons before the newline belong to this line */
+			colonMask &= (nlMask & -nlMask) - 1;
+		}
+		if (colonMask) {
+			*colon = p + __builtin_ctz(colonMask);
+		}
+		if (nlMask) {
+			return p + __builtin_ctz(nlMask);
+		}
+	}
+#endif
+
+	for (; p < end; p++) {
+		if (*p == '\n') {
+			return p;
+		}
+		if ((*p == ':') && !*colon) {
+			*colon = p;
+		}
+	}
+	return end;
+}
+
+/******************************************************************************
+ * Input streams
+ *****************************************************************************/
+
+bool InputOpen(struct InputStream *in, int fd)
+{
+	struct stat st;
+
+	memset(in, 0, sizeof(*in));
+	in->fd = fd;
+
+	if (fstat(fd, &st)) {
+		return false;
+	}
+
+	if (S_ISREG(st.st_mode)) {
+		off_t offset = lseek(fd, 0, SEEK_CUR);
+		if ((offset < 0) || (offset >= st.st_size)) {
+			in->eof = true;
+			return (offset >= 0);
+		}
+		void *map = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (map != MAP_FAILED) {
+			madvise(map, st.st_size, MADV_SEQUENTIAL);
+			in->mapped = true;
+			in->eof = true;
+			in->data = map;
+			in->size = st.st_size;
+			in->pos = offset;
+			return true;
+		}
+	}
+
+	in->capacity = INPUT_BLOCK_SIZE;
+	in->data = malloc(in->capacity);
+	return (NULL != in->data);
+}
+
+bool InputOpenPath(struct InputStream *in, const char *path)
+{
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return false;
+	}
+	if (!InputOpen(in, fd)) {
+		int err = errno;
+		close(fd);
+		errno = err;
+		return false;
+	}
+	in->ownsFd = true;
+	return true;
+}
+
+void InputOpenMemory(struct InputStream *in, const char *data, size_t size)
+{
+	memset(in, 0, sizeof(*in));
+	in->fd = -1;
+	in->mapped = true;
+	in->borrowed = true;
+	in->eof = true;
+	in->data = (char *)data;
+	in->size = size;
+}
+
+/**
+ * Move the unconsumed tail of the buffer to the front, growing the buffer
+ * if the tail already fills it, and read as much as fits behind it.
+ */
+static void InputFill(struct InputStream *in)
+{
+	size_t tail = in->size - in->pos;
+
+	if (in->fillHook) {
+		in->fillHook(in->fillHookArg);
+	}
+	memmove(in->data, in->data + in->pos, tail);
+	in->pos = 0;
+	in->size = tail;
+
+	if (in->size == in->capacity) {
+		char *data = realloc(in->data, in->capacity * 2);
+		if (!data) {
+			perror("realloc");
+			in->eof = true;
+			return;
+		}
+		in->data = data;
+		in->capacity *= 2;
+	}
+
+	while (in->size < in->capacity) {
+		uint64_t start = StatsStart();
+		ssize_t ret = read(in->fd, in->data + in->size, in->capacity - in->size);
+		StatsStop(PhaseRead, start);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("read");
+		}
+		if (ret <= 0) {
+			in->eof = true;
+			return;
+		}
+		in->size += ret;
+		/* Hand out what we have rather than wait on a slow pipe */
+		if (memchr(in->data + in->size - ret, '\n', ret)) {
+			return;
+		}
+	}
+}
+
+bool InputReadLine(struct InputStream *in, struct InputLine *line)
+{
+	while (1) {
+		const char *start = in->data + in->pos;
+		const char *end = in->data + in->size;
+		const char *nl = ScanLine(start, end, &line->colon);
+
+		if ((nl < end) || (in->eof && (start < end))) {
+			line->start = start;
+			line->length = nl - start + (nl < end);
+			in->pos += line->length;
+			return true;
+		}
+		if (in->eof) {
+			return false;
+		}
+		InputFill(in);
+	}
+}
+
+void InputClose(struct InputStream *in)
+{
+	if (in->borrowed) {
+		/* Nothing to release */
+	}
+	else if (in->mapped) {
+		munmap(in->data, in->size);
+	}
+	else {
+		free(in->data);
+	}
+	if (in->ownsFd) {
+		close(in->fd);
+	}
+	memset(in, 0, sizeof(*in));
+}
+
+/******************************************************************************
+ * Hex parsing
+ *****************************************************************************/
+
+uint32_t ParseHexScalar(const char *p, const char *end)
+{
+	uint32_t val = 0;
+
+	while ((p < end) && ((*p == ' ') || ((*p >= '\t') && (*p <= '\r')))) {
+		p++;
+	}
+	if ((p + 2 < end) && (p[0] == '0') && ((p[1] | 0x20) == 'x') && IsHexDigit(p[2])) {
+		p += 2;
+	}
+	for (; (p < end) && IsHexDigit(*p); p++) {
+		val = (val << 4) | HexDigitValue(*p);
+	}
+	return val;
+}
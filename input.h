@@ -0,0 +1,139 @@
+#ifndef INPUT_H
+#define INPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/******************************************************************************
+ * Line-oriented input
+ *****************************************************************************/
+
+/*
+ * Regular files are mapped into memory and lines point straight into the
+ * mapping. Pipes and terminals are read in large blocks into a buffer
+ * that grows to fit the longest line, so lines of any length are returned
+ * whole. A line returned by InputReadLine stays valid until the next call.
+ */
+struct InputStream {
+	int fd;
+	/* The whole input is in data and lines stay valid until InputClose */
+	bool mapped;
+	/* data belongs to the caller, see InputOpenMemory */
+	bool borrowed;
+	/* fd was opened by InputOpenPath and is closed with the stream */
+	bool ownsFd;
+	bool eof;
+	char *data;
+	size_t size;
+	size_t capacity;
+	size_t pos;
+	/* Called before the read buffer is recycled, see InputSetFillHook */
+	void (*fillHook)(void *arg);
+	void *fillHookArg;
+};
+
+struct InputLine {
+	const char *start;
+	/* Length including the trailing newline, if there is one */
+	size_t length;
+	/* First ':' in the line or NULL */
+	const char *colon;
+};
+
+bool InputOpen(struct InputStream *in, int fd);
+bool InputOpenPath(struct InputStream *in, const char *path);
+void InputOpenMemory(struct InputStream *in, const char *data, size_t size);
+bool InputReadLine(struct InputStream *in, struct InputLine *line);
+void InputClose(struct InputStream *in);
+
+/**
+ * Register a function to call before the read buffer of a pipe is reused,
+ * i.e. when the lines returned so far are about to become invalid. This
+ * lets the caller hold on to lines until then instead of copying them.
+ */
+static inline void InputSetFillHook(struct InputStream *in,
+		void (*hook)(void *arg), void *arg)
+{
+	in->fillHook = hook;
+	in->fillHookArg = arg;
+}
+
+/**
+ * Find the end of the line starting at p, i.e. the first '\n' or end.
+ * The first ':' before it is stored to *colon (NULL if there is none).
+ */
+const char *ScanLine(const char *p, const char *end, const char **colon);
+
+/******************************************************************************
+ * Hex parsing
+ *****************************************************************************/
+
+enum {
+	SWAR_HIGH = 0x80,
+};
+
+#define SWAR_BYTES(x) ((uint64_t)(x) * 0x0101010101010101ull)
+
+/**
+ * Returns a mask with the high bit set in each byte of x that lies in
+ * [lo, hi]. All the bytes of x must be below 0x80.
+ */
+static inline uint64_t SwarInRange(uint64_t x, uint8_t lo, uint8_t hi)
+{
+	uint64_t aboveLo = x + SWAR_BYTES(SWAR_HIGH - lo);
+	uint64_t aboveHi = x + SWAR_BYTES(0x7f - hi);
+	return aboveLo & ~aboveHi & SWAR_BYTES(SWAR_HIGH);
+}
+
+/**
+ * Parse exactly 8 hex digits at p, all eight lanes at once (SWAR).
+ * Returns false if any of them is not a hex digit.
+ */
+static inline bool ParseHex8(const char *p, uint32_t *val)
+{
+	uint64_t x;
+	memcpy(&x, p, sizeof(x));
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+	x = __builtin_bswap64(x);
+#endif
+
+	if (x & SWAR_BYTES(SWAR_HIGH)) {
+		return false;
+	}
+	uint64_t lower = x | SWAR_BYTES(0x20);
+	uint64_t isDigit = SwarInRange(x, '0', '9');
+	uint64_t isLetter = SwarInRange(lower, 'a', 'f');
+	if ((isDigit | isLetter) != SWAR_BYTES(SWAR_HIGH)) {
+		return false;
+	}
+
+	/* '0'..'9' -> 0..9, 'a'..'f' -> 1..6 + 9 */
+	uint64_t nibbles = (x & SWAR_BYTES(0x0f)) + (isLetter >> 7) * 9;
+
+	/* The first character is the most significant nibble */
+	uint64_t bytes = ((nibbles << 4) | (nibbles >> 8)) & 0x00ff00ff00ff00ffull;
+	uint64_t halves = ((bytes << 8) | (bytes >> 16)) & 0x0000ffff0000ffffull;
+	*val = (uint32_t)((halves << 16) | (halves >> 32));
+	return true;
+}
+
+static inline bool IsHexDigit(char c)
+{
+	return ((c >= '0') && (c <= '9'))
+		|| ((c | 0x20) >= 'a' && (c | 0x20) <= 'f');
+}
+
+static inline uint32_t HexDigitValue(char c)
+{
+	return (c <= '9') ? (uint32_t)(c - '0') : (uint32_t)((c | 0x20) - 'a' + 10);
+}
+
+/**
+ * Parse a hex number like strtol(p, NULL, 16) does for the values that
+ * fit in 32 bits: leading whitespace and a "0x" prefix are skipped.
+ */
+uint32_t ParseHexScalar(const char *p, const char *end);
+
+#endif /* INPUT_H */
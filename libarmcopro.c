@@ -0,0 +1,391 @@
+#include <string.h>
+
+#include "libarmcopro.h"
+#include "mcr_encoding.h"
+#include "output.h"
+#include "scan.h"
+
+/******************************************************************************
+ * Coprocessor Register Descriptions
+ *****************************************************************************/
+
+/*
+ * The register descriptions live in regdb.csv, which gen_regdb compiles
+ * into regdb.h: a struct-of-arrays sorted by key with the strings
+ * interned into RegDbStrings, and a perfect hash over the keys.
+ */
+#include "regdb.h"
+
+#define STRING_UNWRAP(str) ((NULL == str) ? "Unknown" : str)
+
+#define MAX(a, b) (((a) > (b)) ? (a) : (b))
+
+/* Compile-time checks that the public limits hold for the database */
+typedef char ArmCoproVariantsFit[((int)REGDB_MAX_VARIANTS <= (int)ARMCOPRO_MAX_VARIANTS) ? 1 : -1];
+typedef char ArmCoproIsasFit[(REGDB_ISA_COUNT <= 32) ? 1 : -1];
+
+static inline const char *RegDbString(uint16_t offset)
+{
+	return offset ? (RegDbStrings + offset) : NULL;
+}
+
+static inline void RegDbGet(size_t index, struct ArmCoproReg *reg)
+{
+	uint32_t key = RegDbKey[index];
+
+	reg->name = RegDbString(RegDbName[index]);
+	reg->comment = RegDbString(RegDbComment[index]);
+	reg->isa = RegDbIsa[index];
+	reg->cp = (key >> 14) & Mask_Cp;
+	reg->wide = key & REGDB_KEY_WIDE;
+	if (reg->wide) {
+		reg->crn = 0;
+		reg->op1 = (key >> 4) & Mask_Op1Wide;
+		reg->crm = key & Mask_CRm;
+		reg->op2 = 0;
+	}
+	else {
+		reg->crn = (key >> 10) & Mask_CRn;
+		reg->op1 = (key >> 7) & Mask_Op1;
+		reg->crm = (key >> 3) & Mask_CRm;
+		reg->op2 = key & Mask_Op2;
+	}
+	reg->firstField = RegDbFieldFirst[index];
+	reg->numFields = RegDbFieldCount[index];
+}
+
+size_t ArmCoproRegCount(void)
+{
+	return REGDB_COUNT;
+}
+
+void ArmCoproRegGet(size_t index, struct ArmCoproReg *reg)
+{
+	RegDbGet(index, reg);
+}
+
+void ArmCoproFieldGet(const struct ArmCoproReg *reg, size_t index, struct ArmCoproField *field)
+{
+	size_t i = reg->firstField + index;
+
+	field->name = RegDbString(RegDbFieldName[i]);
+	field->isa = RegDbFieldIsa[i];
+	field->lsb = RegDbFieldLsb[i];
+	field->width = RegDbFieldWidth[i];
+}
+
+size_t ArmCoproIsaCount(void)
+{
+	return REGDB_ISA_COUNT;
+}
+
+const char *ArmCoproIsaName(size_t index)
+{
+	return (index < REGDB_ISA_COUNT) ? RegDbIsaNames[index] : NULL;
+}
+
+/******************************************************************************
+ * Decoding
+ *****************************************************************************/
+
+/*
+ * The coprocessor, the form and the operands together form the key of
+ * one table for all coprocessors: CRn, Op1, CRm and Op2 for MCR/MRC,
+ * Op1 and CRm for MCRR/MRRC. The perfect hash gives the number of the
+ * key, and the index table of the selected ISA revisions the entries
+ * of that key which apply to them, in the order of the database, so
+ * that keys with several variants (e.g. ISB vs FlushPrefetch) print the
+ * same way a linear scan would.
+ */
+static inline const uint16_t *SelectRegs(uint32_t isa)
+{
+	return RegDbSelect[isa & (REGDB_SELECTIONS - 1)];
+}
+
+static inline void LookupRegs(struct ArmCoproInsn *insn, const uint16_t *select)
+{
+	uint32_t key = insn->wide ? REGDB_KEY64(insn->cp, insn->op1, insn->crm)
+		: REGDB_KEY(insn->cp, insn->crn, insn->op1, insn->crm, insn->op2);
+	uint16_t number = RegDbHash[RegDbHashSlot(key)];
+
+	insn->numRegs = 0;
+	insn->isa = 0;
+	if (!number) {
+		return;
+	}
+	size_t first = select[number - 1];
+	size_t end = select[number];
+	/* Another key may hash to the slot */
+	if ((first == end) || (RegDbKey[RegDbSelected[first]] != key)) {
+		return;
+	}
+	for (size_t j = first; j < end; j++) {
+		size_t i = RegDbSelected[j];
+		struct ArmCoproReg *reg = &insn->regs[insn->numRegs++];
+		reg->name = RegDbString(RegDbName[i]);
+		reg->comment = RegDbString(RegDbComment[i]);
+		reg->isa = RegDbIsa[i];
+		reg->cp = insn->cp;
+		reg->wide = insn->wide;
+		reg->crn = insn->crn;
+		reg->op1 = insn->op1;
+		reg->crm = insn->crm;
+		reg->op2 = insn->op2;
+		reg->firstField = RegDbFieldFirst[i];
+		reg->numFields = RegDbFieldCount[i];
+		insn->isa |= RegDbIsa[i];
+	}
+}
+
+/*
+ * Both forms share L, Rd, the coprocessor and CRm; bit 25 tells them
+ * apart.
+ */
+static inline void DecodeAccess(uint32_t opcode, const uint16_t *select, struct ArmCoproInsn *insn)
+{
+	insn->opcode = opcode;
+	insn->valid = true;
+	insn->mrc = Extract(Ldop, opcode);
+	insn->wide = !Extract(Narrow, opcode);
+	insn->cp = Extract(Cp, opcode);
+	insn->crm = Extract(CRm, opcode);
+	insn->rd = Extract(Rd, opcode);
+	if (insn->wide) {
+		insn->op1 = Extract(Op1Wide, opcode);
+		insn->crn = 0;
+		insn->op2 = 0;
+		insn->rd2 = Extract(Rd2, opcode);
+	}
+	else {
+		insn->op1 = Extract(Op1, opcode);
+		insn->crn = Extract(CRn, opcode);
+		insn->op2 = Extract(Op2, opcode);
+		insn->rd2 = 0;
+	}
+	LookupRegs(insn, select);
+}
+
+static inline void DecodeOther(uint32_t opcode, struct ArmCoproInsn *insn)
+{
+	insn->opcode = opcode;
+	insn->valid = false;
+	insn->numRegs = 0;
+}
+
+void ArmCoproDecode(uint32_t opcode, uint32_t isa, struct ArmCoproInsn *insn)
+{
+	if (IsCoproAccess(opcode)) {
+		DecodeAccess(opcode, SelectRegs(isa), insn);
+	}
+	else {
+		DecodeOther(opcode, insn);
+	}
+}
+
+size_t ArmCoproDecodeBatch(const uint32_t *in, size_t n, struct ArmCoproInsn *out, uint32_t isa)
+{
+	static const struct WordPattern pattern = COPRO_ACCESS_PATTERN;
+	const uint16_t *select = SelectRegs(isa);
+	size_t found = 0;
+	size_t i = 0;
+
+	/* Find the accesses several words at a time, the rest is just stores */
+	while (i < n) {
+		size_t next = FindWordPattern((const uint8_t *)in, n, i, &pattern);
+		for (; i < next; i++) {
+			DecodeOther(in[i], &out[i]);
+		}
+		if (i < n) {
+			DecodeAccess(in[i], select, &out[i]);
+			found++;
+			i++;
+		}
+	}
+	return found;
+}
+
+/******************************************************************************
+ * Annotation formatting
+ *****************************************************************************/
+
+enum {
+	/* "MCR, 15, 7, r15, cr15, cr15, {7}\n" and the "CRn=..." line */
+	ANNOTATION_HEADER_MAX = 2 * 64,
+	ANNOTATION_DESC_MAX = sizeof("[] : \n") + REGDB_MAX_NAME_LENGTH
+		+ MAX(REGDB_MAX_COMMENT_LENGTH, sizeof("Unknown")),
+	ANNOTATION_MAX = ANNOTATION_HEADER_MAX + REGDB_MAX_VARIANTS * ANNOTATION_DESC_MAX,
+	/* "[%s] = 0x%08x :" and " %s=%u" for each field */
+	ANNOTATION_VALUE_MAX = sizeof("[] = 0x01234567 :\n") + REGDB_MAX_NAME_LENGTH
+		+ REGDB_MAX_FIELDS_TEXT,
+};
+
+typedef char ArmCoproFormatFits[((int)ANNOTATION_MAX <= (int)ARMCOPRO_FORMAT_MAX) ? 1 : -1];
+typedef char ArmCoproFormatValueFits[((int)ANNOTATION_VALUE_MAX <= (int)ARMCOPRO_FORMAT_MAX) ? 1 : -1];
+
+static char *FormatRegs(char *p, const struct ArmCoproInsn *insn)
+{
+	for (size_t i = 0; i < insn->numRegs; i++)
+	{
+		/* "[%s] : %s\n" */
+		p = FormatString(p, "[");
+		p = FormatString(p, STRING_UNWRAP(insn->regs[i].name));
+		p = FormatString(p, "] : ");
+		p = FormatString(p, STRING_UNWRAP(insn->regs[i].comment));
+		p = FormatString(p, "\n");
+	}
+	return p;
+}
+
+/*
+ * "%s, %d, %d, r%d, r%d, cr%d\n"
+ * "%s, Op1=%d CRm=%d Rd=%d Rd2=%d CP=%d\n"
+ */
+static char *FormatWide(char *p, const struct ArmCoproInsn *insn)
+{
+	const char *mnemonic = insn->mrc ? "MRRC" : "MCRR";
+
+	p = FormatString(p, mnemonic);
+	p = FormatString(p, ", ");
+	p = FormatUnsigned(p, insn->cp);
+	p = FormatString(p, ", ");
+	p = FormatUnsigned(p, insn->op1);
+	p = FormatString(p, ", r");
+	p = FormatUnsigned(p, insn->rd);
+	p = FormatString(p, ", r");
+	p = FormatUnsigned(p, insn->rd2);
+	p = FormatString(p, ", cr");
+	p = FormatUnsigned(p, insn->crm);
+	p = FormatString(p, "\n");
+
+	p = FormatString(p, mnemonic);
+	p = FormatString(p, ", Op1=");
+	p = FormatUnsigned(p, insn->op1);
+	p = FormatString(p, " CRm=");
+	p = FormatUnsigned(p, insn->crm);
+	p = FormatString(p, " Rd=");
+	p = FormatUnsigned(p, insn->rd);
+	p = FormatString(p, " Rd2=");
+	p = FormatUnsigned(p, insn->rd2);
+	p = FormatString(p, " CP=");
+	p = FormatUnsigned(p, insn->cp);
+	p = FormatString(p, "\n");
+	return FormatRegs(p, insn);
+}
+
+char *ArmCoproFormat(char *p, const struct ArmCoproInsn *insn)
+{
+	const char *mnemonic = insn->mrc ? "MRC" : "MCR";
+
+	if (!insn->valid) {
+		return p;
+	}
+	if (insn->wide) {
+		return FormatWide(p, insn);
+	}
+
+	/* "%s, %d, %d, r%d, cr%d, cr%d, {%d}\n" */
+	p = FormatString(p, mnemonic);
+	p = FormatString(p, ", ");
+	p = FormatUnsigned(p, insn->cp);
+	p = FormatString(p, ", ");
+	p = FormatUnsigned(p, insn->op1);
+	p = FormatString(p, ", r");
+	p = FormatUnsigned(p, insn->rd);
+	p = FormatString(p, ", cr");
+	p = FormatUnsigned(p, insn->crn);
+	p = FormatString(p, ", cr");
+	p = FormatUnsigned(p, insn->crm);
+	p = FormatString(p, ", {");
+	p = FormatUnsigned(p, insn->op2);
+	p = FormatString(p, "}\n");
+
+	/* "%s, CRn=%d Op1=%d CRm=%d Op2=%d Rd=%d CP=%d\n" */
+	p = FormatString(p, mnemonic);
+	p = FormatString(p, ", CRn=");
+	p = FormatUnsigned(p, insn->crn);
+	p = FormatString(p, " Op1=");
+	p = FormatUnsigned(p, insn->op1);
+	p = FormatString(p, " CRm=");
+	p = FormatUnsigned(p, insn->crm);
+	p = FormatString(p, " Op2=");
+	p = FormatUnsigned(p, insn->op2);
+	p = FormatString(p, " Rd=");
+	p = FormatUnsigned(p, insn->rd);
+	p = FormatString(p, " CP=");
+	p = FormatUnsigned(p, insn->cp);
+	p = FormatString(p, "\n");
+	return FormatRegs(p, insn);
+}
+
+/**
+ * Whether another field of the selected revisions shares a bit with field
+ * i, e.g. HA and BR of SCTLR, which are bit 17 on different cores.
+ */
+static bool FieldCollides(const struct ArmCoproReg *reg, size_t i, uint32_t isa)
+{
+	uint32_t msb = RegDbFieldLsb[i] + RegDbFieldWidth[i] - 1;
+
+	for (size_t j = reg->firstField; j < (size_t)reg->firstField + reg->numFields; j++) {
+		if ((j != i) && (RegDbFieldIsa[j] & isa) && (RegDbFieldLsb[j] <= msb)
+				&& (RegDbFieldLsb[i] <= RegDbFieldLsb[j] + RegDbFieldWidth[j] - 1)) {
+			return true;
+		}
+	}
+	return false;
+}
+
+static char *FormatField(char *p, size_t i, uint32_t value)
+{
+	uint32_t width = RegDbFieldWidth[i];
+	uint32_t mask = (width == 32) ? 0xffffffffu : ((1u << width) - 1);
+
+	p = FormatString(p, " ");
+	p = FormatString(p, RegDbString(RegDbFieldName[i]));
+	p = FormatString(p, "=");
+	return FormatUnsigned(p, (value >> RegDbFieldLsb[i]) & mask);
+}
+
+char *ArmCoproFormatValue(char *p, const struct ArmCoproReg *reg, uint32_t value, uint32_t isa)
+{
+	size_t end = (size_t)reg->firstField + reg->numFields;
+	uint32_t collisions = 0;
+
+	if (!reg->numFields) {
+		return p;
+	}
+
+	p = FormatString(p, "[");
+	p = FormatString(p, STRING_UNWRAP(reg->name));
+	p = FormatString(p, "] = 0x");
+	p = FormatHex32(p, value);
+	p = FormatString(p, " :");
+
+	for (size_t i = reg->firstField; i < end; i++) {
+		if (!(RegDbFieldIsa[i] & isa)) {
+			continue;
+		}
+		if (FieldCollides(reg, i, isa)) {
+			collisions |= RegDbFieldIsa[i] & isa;
+			continue;
+		}
+		p = FormatField(p, i, value);
+	}
+
+	/* The fields that mean different things on different revisions */
+	for (size_t r = 0; r < REGDB_ISA_COUNT; r++) {
+		if (!(collisions & (1u << r))) {
+			continue;
+		}
+		p = FormatString(p, " (");
+		p = FormatString(p, RegDbIsaNames[r]);
+		p = FormatString(p, ":");
+		for (size_t i = reg->firstField; i < end; i++) {
+			if ((RegDbFieldIsa[i] & (1u << r)) && FieldCollides(reg, i, isa)) {
+				p = FormatField(p, i, value);
+			}
+		}
+		p = FormatString(p, ")");
+	}
+	p = FormatString(p, "\n");
+	return p;
+}
@@ -0,0 +1,148 @@
+#ifndef LIBARMCOPRO_H
+#define LIBARMCOPRO_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * libARMCopro: decoding ARM coprocessor register accesses
+ *****************************************************************************/
+
+/*
+ * The accesses decoded are MCR/MRC and the 64-bit MCRR/MRRC to the
+ * architected coprocessors: CP15, CP14 and the VFP system registers on
+ * CP10/11.
+ *
+ * The decoder works on constant tables only: it neither allocates memory
+ * nor does any I/O, and it may be called from any number of threads.
+ *
+ * The ISA revisions are selected with a mask in which bit i stands for
+ * the revision ArmCoproIsaName(i). Registers whose description applies to
+ * none of the selected revisions are not reported.
+ */
+#define ARMCOPRO_ISA_ALL 0xffffffffu
+
+/*
+ * The shared library is built with hidden visibility, so that only the
+ * functions below are exported and not the helpers the library is made of.
+ */
+#define ARMCOPRO_API __attribute__((visibility("default")))
+
+enum {
+	/* Registers one encoding may stand for on different revisions */
+	ARMCOPRO_MAX_VARIANTS = 2,
+	/* Room needed by ArmCoproFormat */
+	ARMCOPRO_FORMAT_MAX = 512,
+};
+
+struct ArmCoproReg {
+	const char *name;
+	/* The description from the manual, or NULL */
+	const char *comment;
+	/* The ISA revisions the description applies to */
+	uint32_t isa;
+	uint8_t cp;
+	/* Accessed with MCRR/MRRC; crn and op2 are 0 then, op1 has 4 bits */
+	bool wide;
+	uint8_t crn;
+	uint8_t op1;
+	uint8_t crm;
+	uint8_t op2;
+	/* The bitfields known for the register, for ArmCoproFieldGet */
+	uint16_t firstField;
+	uint8_t numFields;
+};
+
+struct ArmCoproField {
+	const char *name;
+	/* The ISA revisions the field exists on */
+	uint32_t isa;
+	uint8_t lsb;
+	uint8_t width;
+};
+
+struct ArmCoproInsn {
+	uint32_t opcode;
+	/*
+	 * Whether opcode is a coprocessor register access at all; nothing
+	 * else is set if not
+	 */
+	bool valid;
+	/* MRC or MRRC (coprocessor to core register) rather than MCR/MCRR */
+	bool mrc;
+	/* MCRR/MRRC; crn and op2 are 0 then, op1 has 4 bits */
+	bool wide;
+	uint8_t cp;
+	uint8_t op1;
+	uint8_t crn;
+	uint8_t crm;
+	uint8_t op2;
+	uint8_t rd;
+	/* The second core register of MCRR/MRRC */
+	uint8_t rd2;
+	/* The registers found, in database order */
+	uint8_t numRegs;
+	/* The ISA revisions any of them applies to, 0 if none was found */
+	uint32_t isa;
+	struct ArmCoproReg regs[ARMCOPRO_MAX_VARIANTS];
+};
+
+ARMCOPRO_API size_t ArmCoproIsaCount(void);
+/* The short name of a revision, e.g. "a9" */
+ARMCOPRO_API const char *ArmCoproIsaName(size_t index);
+
+/**
+ * Decode a single instruction into *insn.
+ */
+ARMCOPRO_API void ArmCoproDecode(uint32_t opcode, uint32_t isa, struct ArmCoproInsn *insn);
+
+/**
+ * Decode n instructions into out[0..n-1], which is faster than decoding
+ * them one by one as most opcodes are not coprocessor accesses at all.
+ * For those, only opcode, valid and numRegs are written. Returns the
+ * number of accesses.
+ */
+ARMCOPRO_API size_t ArmCoproDecodeBatch(const uint32_t *in, size_t n, struct ArmCoproInsn *out, uint32_t isa);
+
+/**
+ * Format the annotation of a decoded access into buf, which must have
+ * room for ARMCOPRO_FORMAT_MAX bytes:
+ *   MRC, 15, 0, r0, cr1, cr0, {0}
+ *   MRC, CRn=1 Op1=0 CRm=0 Op2=0 Rd=0 CP=15
+ *   [SCTLR] : System Control Register
+ * or for MCRR/MRRC:
+ *   MRRC, 15, 0, r0, r1, cr2
+ *   MRRC, Op1=0 CRm=2 Rd=0 Rd2=1 CP=15
+ *   [TTBR0] : Translation Table Base Register 0
+ * with one line per register found. Returns the end of the text, which
+ * is not NUL-terminated. Nothing is written for other instructions.
+ */
+ARMCOPRO_API char *ArmCoproFormat(char *buf, const struct ArmCoproInsn *insn);
+
+/**
+ * Get the bitfield number index of a register, which must be below
+ * reg->numFields. The fields are in order of their bits.
+ */
+ARMCOPRO_API void ArmCoproFieldGet(const struct ArmCoproReg *reg, size_t index, struct ArmCoproField *field);
+
+/**
+ * Format a value written to a register into buf, which must have room for
+ * ARMCOPRO_FORMAT_MAX bytes, with each field on the selected revisions:
+ *   [SCTLR] = 0x00c5187d : M=1 A=0 C=1 ... TE=0
+ * Fields that share bits with a field of another selected revision are
+ * listed after the others, grouped by revision:
+ *   [SCTLR] = 0x00c5187d : M=1 ... TE=0 (a9: HA=0) (a15: HA=0 WXN=0) (r4: BR=0 DZ=0)
+ * Returns the end of the text, which is not NUL-terminated. Nothing is
+ * written for registers without fields.
+ */
+ARMCOPRO_API char *ArmCoproFormatValue(char *buf, const struct ArmCoproReg *reg, uint32_t value, uint32_t isa);
+
+/**
+ * The registers of the database, to enumerate them. index must be below
+ * ArmCoproRegCount().
+ */
+ARMCOPRO_API size_t ArmCoproRegCount(void);
+ARMCOPRO_API void ArmCoproRegGet(size_t index, struct ArmCoproReg *reg);
+
+#endif /* LIBARMCOPRO_H */
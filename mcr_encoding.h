@@ -0,0 +1,134 @@
+#ifndef MCR_ENCODING_H
+#define MCR_ENCODING_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+	B0001 = 1,
+	B0111 = 7,
+	B1110 = 14,
+	B1111 = 15,
+};
+
+/******************************************************************************
+ * Accessors to manipulate bitfields
+ *****************************************************************************/
+
+/* It would be nice to use functions to explicitely specify types,
+ * but it is impossible to use functions to initialize static constants
+ */
+
+#define Pack(_Field, val) ((val & (Mask_ ##_Field)) << (ShiftWidth_ ##_Field))
+#define Extract(_Field, opcode) ((opcode >> (ShiftWidth_ ##_Field)) & (Mask_ ##_Field))
+
+#define MaskInReg(_Field) ((Mask_ ##_Field) << (ShiftWidth_ ##_Field))
+
+/******************************************************************************
+ * MCR/MRC definitions
+ *****************************************************************************/
+
+/*
+ * MCR/MRC format:
+ * 31   27   23   19   15
+ * YYYY 1110 YYYL YYYY RRRR 1111 YYY1 YYYY
+ * COND YYYY OP1L CR_N R__D 1111 OP21 CR_M
+ *
+ * MCRR/MRRC format, for 64-bit registers:
+ * 31   27   23   19   15
+ * YYYY 1100 010L RRRR RRRR 1111 YYYY YYYY
+ * COND YYYY YYYL RD_2 R__D 1111 OP1_ CR_M
+ *
+ * Bits 11:8 are the coprocessor. Only the architected ones are decoded:
+ * CP14 (debug, ThumbEE, Jazelle), CP15 (system control) and CP10/11
+ * (VFP and Advanced SIMD). Those are exactly the ones with bits 11 and 9
+ * set, so a single mask and value per form tells the accesses apart
+ * from everything else, CDP (bit 4 clear), LDC/STC and SVC included.
+ */
+enum {
+	MaskMcrMrc_24_28 = B1110,
+	MaskMcrMrc_8_11 = B1111,
+	/* An MCR/MRC to CP15 */
+	MaskMcrMrc = (B1111 << 24) | (MaskMcrMrc_8_11 << 8) | (B0001 << 4),
+	ValueMcrMrc = (MaskMcrMrc_24_28 << 24) | (MaskMcrMrc_8_11 << 8) | (B0001 << 4),
+
+	/* The coprocessors decoded: 10, 11, 14 and 15 */
+	MaskCoproSpace = 0xA00,
+
+	/* The two forms of coprocessor register accesses */
+	MaskCoproReg = (B1111 << 24) | MaskCoproSpace | (B0001 << 4),
+	ValueCoproReg = (B1110 << 24) | MaskCoproSpace | (B0001 << 4),
+	MaskCoproWide = (0x7F << 21) | MaskCoproSpace,
+	ValueCoproWide = (0x62 << 21) | MaskCoproSpace,
+
+	/* Set for MCR/MRC, clear for MCRR/MRRC */
+	ShiftWidth_Narrow = 25,
+	ShiftWidth_Op1 = 21,
+	ShiftWidth_Ldop = 20,
+	ShiftWidth_CRn = 16,
+	ShiftWidth_Rd2 = 16,
+	ShiftWidth_Rd = 12,
+	ShiftWidth_Cp = 8,
+	ShiftWidth_Op2 = 5,
+	ShiftWidth_Op1Wide = 4,
+	ShiftWidth_CRm = 0,
+
+	Mask_1bit = B0001,
+	Mask_3bits = B0111,
+	Mask_4bits = B1111,
+
+	Mask_Narrow = Mask_1bit,
+	Mask_Op1 = Mask_3bits,
+	Mask_Ldop = Mask_1bit,
+	Mask_CRn = Mask_4bits,
+	Mask_Rd2 = Mask_4bits,
+	Mask_Rd = Mask_4bits,
+	Mask_Cp = Mask_4bits,
+	Mask_Op2 = Mask_3bits,
+	Mask_Op1Wide = Mask_4bits,
+	Mask_CRm = Mask_4bits,
+
+	Mask_Op1_CRm_Op2_CRn = MaskInReg(Op1) | MaskInReg(CRn) | MaskInReg(CRm) | MaskInReg(Op2),
+};
+
+/* Both forms, as the initializer of a struct WordPattern (scan.h) */
+#define COPRO_ACCESS_PATTERN \
+	{ { MaskCoproReg, MaskCoproWide }, { ValueCoproReg, ValueCoproWide } }
+
+/**
+ * An MCR/MRC (or MCR2/MRC2, the condition is not looked at) to one of
+ * the coprocessors decoded.
+ */
+static inline bool is_mcr_or_mrc(uint32_t opcode)
+{
+	return ValueCoproReg == (opcode & MaskCoproReg);
+}
+
+/**
+ * An MCRR/MRRC to one of the coprocessors decoded.
+ */
+static inline bool is_mcrr_or_mrrc(uint32_t opcode)
+{
+	return ValueCoproWide == (opcode & MaskCoproWide);
+}
+
+/**
+ * Any coprocessor register access, in either form. Most opcodes are
+ * something else, so both masks are tested without a branch.
+ */
+static inline bool IsCoproAccess(uint32_t opcode)
+{
+	return is_mcr_or_mrc(opcode) | is_mcrr_or_mrrc(opcode);
+}
+
+/**
+ * The bits telling apart the registers accessed and the direction, i.e.
+ * the opcode without the condition and the core registers.
+ */
+static inline uint32_t CoproAccessKey(uint32_t opcode)
+{
+	uint32_t core = MaskInReg(Rd) | (Extract(Narrow, opcode) ? 0 : MaskInReg(Rd2));
+	return opcode & ~(0xF0000000u | core);
+}
+
+#endif /* MCR_ENCODING_H */
@@ -0,0 +1,209 @@
+#define _GNU_SOURCE
+
+#include <errno.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "output.h"
+#include "stats.h"
+
+enum {
+	OUTPUT_MAX_SPANS = 1024,
+	OUTPUT_ARENA_SIZE = 1 << 20,
+	OUTPUT_FLUSH_THRESHOLD = 4 << 20,
+
+	OUTPUT_BUFFER_SPANS = 256,
+	OUTPUT_BUFFER_ARENA_SIZE = 64 << 10,
+};
+
+static void *ReallocOrDie(void *ptr, size_t size)
+{
+	void *ret = realloc(ptr, size);
+	if (!ret) {
+		perror("realloc");
+		exit(1);
+	}
+	return ret;
+}
+
+static void *AllocOrDie(size_t size)
+{
+	return ReallocOrDie(NULL, size);
+}
+
+void OutputInit(struct Output *out, int fd)
+{
+	memset(out, 0, sizeof(*out));
+	out->fd = fd;
+	out->maxSpans = OUTPUT_MAX_SPANS;
+	out->spans = AllocOrDie(out->maxSpans * sizeof(out->spans[0]));
+	out->arenaCapacity = OUTPUT_ARENA_SIZE;
+	out->arena = AllocOrDie(out->arenaCapacity);
+}
+
+void OutputInitBuffer(struct Output *out)
+{
+	memset(out, 0, sizeof(*out));
+	out->fd = -1;
+	out->maxSpans = OUTPUT_BUFFER_SPANS;
+	out->spans = AllocOrDie(out->maxSpans * sizeof(out->spans[0]));
+	out->arenaCapacity = OUTPUT_BUFFER_ARENA_SIZE;
+	out->arena = AllocOrDie(out->arenaCapacity);
+}
+
+void OutputFree(struct Output *out)
+{
+	free(out->spans);
+	free(out->arena);
+	memset(out, 0, sizeof(*out));
+}
+
+static void WriteAll(int fd, struct iovec *iov, int count)
+{
+	uint64_t start = StatsStart();
+
+	while (count) {
+		ssize_t ret = writev(fd, iov, count);
+		if (ret < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("write");
+			exit(1);
+		}
+
+		size_t written = ret;
+		while (count && (written >= iov->iov_len)) {
+			written -= iov->iov_len;
+			iov++;
+			count--;
+		}
+		if (count) {
+			iov->iov_base = (char *)iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	StatsStop(PhaseWrite, start);
+}
+
+void OutputFlush(struct Output *out)
+{
+	if (out->fd >= 0) {
+		OutputFlushTo(out, out->fd);
+	}
+}
+
+void OutputFlushTo(struct Output *out, int fd)
+{
+	enum {
+		BATCH = (IOV_MAX < OUTPUT_MAX_SPANS) ? IOV_MAX : OUTPUT_MAX_SPANS,
+	};
+	struct iovec iov[BATCH];
+
+	for (size_t i = 0; i < out->numSpans; ) {
+		int count = 0;
+		for (; (count < BATCH) && (i < out->numSpans); count++, i++) {
+			const struct OutSpan *span = &out->spans[i];
+			iov[count].iov_base = (void *)(span->base ? span->base : out->arena + span->offset);
+			iov[count].iov_len = span->length;
+		}
+		WriteAll(fd, iov, count);
+	}
+
+	out->numSpans = 0;
+	out->arenaSize = 0;
+	out->pending = 0;
+}
+
+void OutputGather(struct Output *out, char *dst)
+{
+	for (size_t i = 0; i < out->numSpans; i++) {
+		const struct OutSpan *span = &out->spans[i];
+		memcpy(dst, span->base ? span->base : out->arena + span->offset, span->length);
+		dst += span->length;
+	}
+
+	out->numSpans = 0;
+	out->arenaSize = 0;
+	out->pending = 0;
+}
+
+static inline void OutputAddSpan(struct Output *out, const char *base,
+		size_t offset, size_t length)
+{
+	if (out->numSpans) {
+		struct OutSpan *last = &out->spans[out->numSpans - 1];
+		bool adjacent = base
+			? (last->base && (last->base + last->length == base))
+			: (!last->base && (last->offset + last->length == offset));
+		if (adjacent) {
+			last->length += length;
+			out->pending += length;
+			return;
+		}
+	}
+
+	if (out->numSpans == out->maxSpans) {
+		if (out->fd < 0) {
+			out->maxSpans *= 2;
+			out->spans = ReallocOrDie(out->spans, out->maxSpans * sizeof(out->spans[0]));
+		}
+		else {
+			/* OutputReserve made sure there is room for arena spans */
+			OutputFlush(out);
+		}
+	}
+
+	struct OutSpan *span = &out->spans[out->numSpans++];
+	span->base = base;
+	span->offset = offset;
+	span->length = length;
+	out->pending += length;
+
+	if ((out->pending >= OUTPUT_FLUSH_THRESHOLD) && (out->fd >= 0)) {
+		OutputFlush(out);
+	}
+}
+
+void OutputSpan(struct Output *out, const char *p, size_t length)
+{
+	if (length) {
+		OutputAddSpan(out, p, 0, length);
+	}
+}
+
+char *OutputReserve(struct Output *out, size_t maxLength)
+{
+	if (out->fd < 0) {
+		/* Arena spans are kept as offsets, so the arena may move */
+		while (out->arenaSize + maxLength > out->arenaCapacity) {
+			out->arenaCapacity *= 2;
+			out->arena = ReallocOrDie(out->arena, out->arenaCapacity);
+		}
+	}
+	else if ((out->arenaSize + maxLength > out->arenaCapacity)
+			|| (out->numSpans == out->maxSpans)) {
+		OutputFlush(out);
+		if (maxLength > out->arenaCapacity) {
+			free(out->arena);
+			out->arenaCapacity = maxLength;
+			out->arena = AllocOrDie(out->arenaCapacity);
+		}
+	}
+	return out->arena + out->arenaSize;
+}
+
+void OutputCommit(struct Output *out, const char *end)
+{
+	size_t offset = out->arenaSize;
+	size_t length = end - (out->arena + offset);
+
+	if (!length) {
+		return;
+	}
+	out->arenaSize += length;
+	OutputAddSpan(out, NULL, offset, length);
+}
@@ -0,0 +1,132 @@
+#ifndef OUTPUT_H
+#define OUTPUT_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+/******************************************************************************
+ * Batched output
+ *****************************************************************************/
+
+/*
+ * Output is collected as a list of spans and written with writev once
+ * enough of it has accumulated. Spans either reference the caller's
+ * memory (e.g. the mapped input echoed in objdump mode), which must stay
+ * valid until the next flush, or bytes formatted into the output arena.
+ * Consecutive references to adjacent memory are merged into one span, so
+ * runs of unchanged input lines go out as a single large write.
+ */
+struct OutSpan {
+	/* NULL if the bytes live in the arena at 'offset' */
+	const char *base;
+	size_t offset;
+	size_t length;
+};
+
+struct Output {
+	/* -1 for a buffer that only grows until OutputFlushTo is called */
+	int fd;
+	struct OutSpan *spans;
+	size_t numSpans;
+	size_t maxSpans;
+	char *arena;
+	size_t arenaSize;
+	size_t arenaCapacity;
+	size_t pending;
+};
+
+void OutputInit(struct Output *out, int fd);
+void OutputInitBuffer(struct Output *out);
+void OutputFlush(struct Output *out);
+void OutputFlushTo(struct Output *out, int fd);
+/**
+ * Copy what was collected (out->pending bytes) to dst instead of writing
+ * it out, and empty the buffer.
+ */
+void OutputGather(struct Output *out, char *dst);
+void OutputFree(struct Output *out);
+
+/**
+ * Reference length bytes at p without copying them.
+ */
+void OutputSpan(struct Output *out, const char *p, size_t length);
+
+/**
+ * Get room for up to maxLength bytes in the arena. Call OutputCommit
+ * with the end of what was actually written.
+ */
+char *OutputReserve(struct Output *out, size_t maxLength);
+void OutputCommit(struct Output *out, const char *end);
+
+static inline void OutputCopy(struct Output *out, const char *p, size_t length)
+{
+	char *dst = OutputReserve(out, length);
+	memcpy(dst, p, length);
+	OutputCommit(out, dst + length);
+}
+
+/******************************************************************************
+ * Formatting helpers
+ *****************************************************************************/
+
+/*
+ * These write into a buffer the caller has reserved and return the new
+ * end of the buffer, so that several of them can be chained without
+ * bounds checks or locale-aware printf machinery.
+ */
+
+static inline char *FormatString(char *p, const char *s)
+{
+	size_t length = strlen(s);
+	memcpy(p, s, length);
+	return p + length;
+}
+
+static inline char *FormatUnsigned(char *p, uint32_t val)
+{
+	char digits[10];
+	size_t n = 0;
+
+	if (val < 10) {
+		*p = '0' + val;
+		return p + 1;
+	}
+	do {
+		digits[n++] = '0' + (val % 10);
+		val /= 10;
+	} while (val);
+	while (n) {
+		*p++ = digits[--n];
+	}
+	return p;
+}
+
+static inline char *FormatHex32(char *p, uint32_t val)
+{
+	static const char hexDigits[16] = "0123456789abcdef";
+	for (int shift = 28; shift >= 0; shift -= 4) {
+		*p++ = hexDigits[(val >> shift) & 0xf];
+	}
+	return p;
+}
+
+/**
+ * Hex without leading zeroes, as in "0x%x"
+ */
+static inline char *FormatHex(char *p, uint32_t val)
+{
+	static const char hexDigits[16] = "0123456789abcdef";
+	int shift = 28;
+
+	while ((shift > 0) && !((val >> shift) & 0xf)) {
+		shift -= 4;
+	}
+	for (; shift >= 0; shift -= 4) {
+		*p++ = hexDigits[(val >> shift) & 0xf];
+	}
+	return p;
+}
+
+#endif /* OUTPUT_H */
@@ -0,0 +1,217 @@
+#define _GNU_SOURCE
+
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "parallel.h"
+
+enum {
+	CHUNK_MAX_SIZE = 4 << 20,
+	CHUNK_MIN_SIZE = 64 << 10,
+	/* Chunks per thread, to balance the load */
+	CHUNKS_PER_THREAD = 4,
+	/* Chunks per thread that may be done but not yet written */
+	CHUNK_WINDOW_PER_THREAD = 4,
+	MAX_THREADS = 256,
+};
+
+struct Chunk {
+	size_t start;
+	size_t end;
+	bool done;
+	struct Output out;
+};
+
+struct ChunkQueue {
+	pthread_mutex_t lock;
+	pthread_cond_t cond;
+	const char *data;
+	struct Chunk *chunks;
+	size_t count;
+	size_t next;
+	size_t written;
+	size_t window;
+	ChunkFn fn;
+	void *arg;
+};
+
+size_t ChunkBoundaryLine(const char *data, size_t size, size_t pos)
+{
+	if (!pos || (pos >= size)) {
+		return (pos >= size) ? size : 0;
+	}
+	const char *nl = memchr(data + pos - 1, '\n', size - pos + 1);
+	return nl ? (size_t)(nl - data) + 1 : size;
+}
+
+size_t ChunkBoundaryWord(const char *data, size_t size, size_t pos)
+{
+	(void)data;
+	pos = (pos + 3) & ~(size_t)3;
+	return (pos >= size) ? size : pos;
+}
+
+unsigned ParallelDefaultThreads(void)
+{
+	long n = sysconf(_SC_NPROCESSORS_ONLN);
+	return (n < 1) ? 1 : (n > MAX_THREADS) ? MAX_THREADS : n;
+}
+
+static void *ChunkWorker(void *opaque)
+{
+	struct ChunkQueue *q = opaque;
+
+	pthread_mutex_lock(&q->lock);
+	while (1) {
+		while ((q->next < q->count) && (q->next >= q->written + q->window)) {
+			pthread_cond_wait(&q->cond, &q->lock);
+		}
+		if (q->next == q->count) {
+			break;
+		}
+		struct Chunk *chunk = &q->chunks[q->next++];
+		pthread_mutex_unlock(&q->lock);
+
+		OutputInitBuffer(&chunk->out);
+		q->fn(&chunk->out, q->data + chunk->start, q->data + chunk->end, q->arg);
+
+		pthread_mutex_lock(&q->lock);
+		chunk->done = true;
+		pthread_cond_broadcast(&q->cond);
+	}
+	pthread_mutex_unlock(&q->lock);
+	return NULL;
+}
+
+/**
+ * Cut the input at the boundaries closest to evenly spaced positions.
+ * Boundaries falling on the same spot give empty chunks, which are dropped.
+ */
+static size_t SplitChunks(struct Chunk *chunks, size_t maxChunks, const char *data,
+		size_t size, size_t chunkSize, ChunkBoundaryFn boundary)
+{
+	size_t count = 0;
+	size_t start = 0;
+
+	while ((start < size) && (count < maxChunks)) {
+		size_t end = (count == maxChunks - 1) ? size : boundary(data, size, start + chunkSize);
+		if (end <= start) {
+			end = size;
+		}
+		memset(&chunks[count], 0, sizeof(chunks[count]));
+		chunks[count].start = start;
+		chunks[count].end = end;
+		count++;
+		start = end;
+	}
+	return count;
+}
+
+bool RunChunked(const char *data, size_t size, unsigned threads,
+		ChunkBoundaryFn boundary, ChunkFn fn, void *arg, int fd)
+{
+	struct ChunkQueue q;
+	pthread_t workers[MAX_THREADS];
+	unsigned started = 0;
+
+	if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+
+	size_t chunkSize = size / ((size_t)threads * CHUNKS_PER_THREAD) + 1;
+	chunkSize = (chunkSize < CHUNK_MIN_SIZE) ? CHUNK_MIN_SIZE
+		: (chunkSize > CHUNK_MAX_SIZE) ? CHUNK_MAX_SIZE : chunkSize;
+	size_t maxChunks = size / chunkSize + 1;
+
+	memset(&q, 0, sizeof(q));
+	q.data = data;
+	q.fn = fn;
+	q.arg = arg;
+	q.window = (size_t)threads * CHUNK_WINDOW_PER_THREAD;
+	q.chunks = malloc(maxChunks * sizeof(q.chunks[0]));
+	if (!q.chunks) {
+		return false;
+	}
+	q.count = SplitChunks(q.chunks, maxChunks, data, size, chunkSize, boundary);
+	pthread_mutex_init(&q.lock, NULL);
+	pthread_cond_init(&q.cond, NULL);
+
+	for (; started < threads; started++) {
+		if (pthread_create(&workers[started], NULL, ChunkWorker, &q)) {
+			break;
+		}
+	}
+	if (!started) {
+		pthread_cond_destroy(&q.cond);
+		pthread_mutex_destroy(&q.lock);
+		free(q.chunks);
+		return false;
+	}
+
+	for (size_t i = 0; i < q.count; i++) {
+		struct Chunk *chunk = &q.chunks[i];
+
+		pthread_mutex_lock(&q.lock);
+		while (!chunk->done) {
+			pthread_cond_wait(&q.cond, &q.lock);
+		}
+		pthread_mutex_unlock(&q.lock);
+
+		OutputFlushTo(&chunk->out, fd);
+		OutputFree(&chunk->out);
+
+		pthread_mutex_lock(&q.lock);
+		q.written++;
+		pthread_cond_broadcast(&q.cond);
+		pthread_mutex_unlock(&q.lock);
+	}
+
+	for (unsigned i = 0; i < started; i++) {
+		pthread_join(workers[i], NULL);
+	}
+	pthread_cond_destroy(&q.cond);
+	pthread_mutex_destroy(&q.lock);
+	free(q.chunks);
+	return true;
+}
+
+struct ThreadCall {
+	void (*fn)(unsigned index, void *arg);
+	void *arg;
+	unsigned index;
+};
+
+static void *ThreadMain(void *opaque)
+{
+	struct ThreadCall *call = opaque;
+	call->fn(call->index, call->arg);
+	return NULL;
+}
+
+void RunThreads(unsigned threads, void (*fn)(unsigned index, void *arg), void *arg)
+{
+	pthread_t workers[MAX_THREADS];
+	struct ThreadCall calls[MAX_THREADS];
+	bool started[MAX_THREADS];
+
+	if (threads > MAX_THREADS) {
+		threads = MAX_THREADS;
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		calls[i].fn = fn;
+		calls[i].arg = arg;
+		calls[i].index = i;
+		started[i] = !pthread_create(&workers[i], NULL, ThreadMain, &calls[i]);
+	}
+	for (unsigned i = 0; i < threads; i++) {
+		if (started[i]) {
+			pthread_join(workers[i], NULL);
+		}
+		else {
+			fn(i, arg);
+		}
+	}
+}
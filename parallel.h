@@ -0,0 +1,53 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include <stdbool.h>
+#include <stddef.h>
+
+#include "output.h"
+
+/******************************************************************************
+ * Parallel chunked processing with ordered output
+ *****************************************************************************/
+
+/*
+ * The input is cut into chunks which a pool of worker threads processes
+ * into per-chunk output buffers. The calling thread writes the buffers
+ * in input order, so the result is byte-identical to processing the
+ * input serially. Only a bounded number of chunks is in flight at once.
+ */
+
+/**
+ * Process [start, end) into out. The whole input stays readable, so a
+ * chunk may look past its end (e.g. for instructions crossing it).
+ */
+typedef void (*ChunkFn)(struct Output *out, const char *start, const char *end, void *arg);
+
+/**
+ * Return where the chunk boundary closest to pos (and not before it)
+ * lies, e.g. the start of the next line.
+ */
+typedef size_t (*ChunkBoundaryFn)(const char *data, size_t size, size_t pos);
+
+size_t ChunkBoundaryLine(const char *data, size_t size, size_t pos);
+/* The next 4-byte aligned offset, for binary data */
+size_t ChunkBoundaryWord(const char *data, size_t size, size_t pos);
+
+unsigned ParallelDefaultThreads(void);
+
+/**
+ * Process data with the given number of threads, writing the output to fd.
+ * Returns false if the threads could not be started; nothing was written
+ * then and the caller should fall back to the serial path.
+ */
+bool RunChunked(const char *data, size_t size, unsigned threads,
+		ChunkBoundaryFn boundary, ChunkFn fn, void *arg, int fd);
+
+/**
+ * Call fn(index, arg) for every index below threads, each on a thread
+ * of its own, and wait for all of them. Calls for which no thread can
+ * be started are made on the calling thread instead.
+ */
+void RunThreads(unsigned threads, void (*fn)(unsigned index, void *arg), void *arg);
+
+#endif /* PARALLEL_H */
@@ -0,0 +1,481 @@
+#include "peephole.h"
+
+enum {
+	CondAlways = 0xE,
+	CondUnconditional = 0xF,
+
+	RegSp = 13,
+	RegLr = 14,
+	RegPc = 15,
+
+	/* r0-r3, r12 and lr, which a callee may change (AAPCS) */
+	CallClobbered = 0x500f,
+
+	DpAnd = 0x0,
+	DpEor = 0x1,
+	DpSub = 0x2,
+	DpRsb = 0x3,
+	DpAdd = 0x4,
+	DpTst = 0x8,
+	DpCmn = 0xB,
+	DpOrr = 0xC,
+	DpMov = 0xD,
+	DpBic = 0xE,
+	DpMvn = 0xF,
+
+	ShiftLsl = 0,
+	ShiftLsr = 1,
+	ShiftAsr = 2,
+	ShiftRor = 3,
+};
+
+#define Field(opcode, lsb, width) (((opcode) >> (lsb)) & ((1u << (width)) - 1))
+
+static inline uint32_t Ror32(uint32_t x, unsigned n)
+{
+	n &= 31;
+	return n ? ((x >> n) | (x << (32 - n))) : x;
+}
+
+void PeepholeInit(struct Peephole *ph,
+		bool (*readLiteral)(void *ctx, uint32_t addr, uint32_t *word), void *ctx)
+{
+	ph->known = 0;
+	ph->pending = 0;
+	for (unsigned i = 0; i < PEEPHOLE_RING_SIZE; i++) {
+		ph->ring[i].addr = 1;
+	}
+	ph->dataSeen = 0;
+	ph->readLiteral = readLiteral;
+	ph->ctx = ctx;
+	ph->lowestLiteral = UINT32_MAX;
+	ph->oldestLiteral = UINT32_MAX;
+	ph->readPc = false;
+}
+
+/**
+ * The value of a source register; the PC reads as the address of the
+ * instruction plus 8.
+ */
+static inline bool ReadReg(struct Peephole *ph, unsigned reg, uint32_t addr, uint32_t *value)
+{
+	if (reg == RegPc) {
+		ph->readPc = true;
+		*value = addr + 8;
+		return true;
+	}
+	return PeepholeValue(ph, reg, value);
+}
+
+/**
+ * Record the result of an instruction. If the condition may fail, the
+ * register keeps a known value only if both outcomes agree. A write to
+ * the PC that always happens leaves the straight-line code.
+ */
+static void Write(struct Peephole *ph, uint32_t cond, unsigned reg, bool known, uint32_t value)
+{
+	uint16_t bit = 1u << reg;
+
+	if (reg == RegPc) {
+		if (cond == CondAlways) {
+			PeepholeReset(ph);
+		}
+		return;
+	}
+	ph->pending &= ~bit;
+	if ((cond != CondAlways) && (!(ph->known & bit) || (ph->values[reg] != value))) {
+		known = false;
+	}
+	if (known) {
+		ph->values[reg] = value;
+		ph->known |= bit;
+	}
+	else {
+		ph->known &= ~bit;
+	}
+}
+
+static inline void Clobber(struct Peephole *ph, uint32_t cond, unsigned reg)
+{
+	Write(ph, cond, reg, false, 0);
+}
+
+/* For fields where 1111 means "none" rather than the PC */
+static inline void ClobberData(struct Peephole *ph, unsigned reg)
+{
+	if (reg != RegPc) {
+		ph->known &= ~(1u << reg);
+		ph->pending &= ~(1u << reg);
+	}
+}
+
+static inline void ClobberCall(struct Peephole *ph)
+{
+	ph->known &= ~CallClobbered;
+	ph->pending &= ~CallClobbered;
+}
+
+static bool ReadLiteral(struct Peephole *ph, uint32_t addr, uint32_t *word)
+{
+	const struct PeepholeWord *slot = &ph->ring[(addr >> 2) & (PEEPHOLE_RING_SIZE - 1)];
+
+	if (addr < ph->lowestLiteral) {
+		ph->lowestLiteral = addr;
+	}
+	if (slot->addr == addr) {
+		*word = slot->word;
+		if (slot->seq < ph->oldestLiteral) {
+			ph->oldestLiteral = slot->seq;
+		}
+		return true;
+	}
+	if (ph->readLiteral && ph->readLiteral(ph->ctx, addr, word)) {
+		ph->oldestLiteral = 0;
+		return true;
+	}
+	return false;
+}
+
+/**
+ * The data-processing operations with a result that only depends on the
+ * operands; the others (ADC, SBC, RSC) depend on the flags.
+ */
+static bool Compute(uint32_t op, uint32_t a, uint32_t b, uint32_t *result)
+{
+	switch (op) {
+	case DpAnd: *result = a & b; return true;
+	case DpEor: *result = a ^ b; return true;
+	case DpSub: *result = a - b; return true;
+	case DpRsb: *result = b - a; return true;
+	case DpAdd: *result = a + b; return true;
+	case DpOrr: *result = a | b; return true;
+	case DpMov: *result = b; return true;
+	case DpBic: *result = a & ~b; return true;
+	case DpMvn: *result = ~b; return true;
+	default: return false;
+	}
+}
+
+/**
+ * Data processing with the second operand already evaluated (if known).
+ * TST, TEQ, CMP and CMN only set the flags.
+ */
+static void StepDataProcessing(struct Peephole *ph, uint32_t addr, uint32_t opcode,
+		bool operandKnown, uint32_t operand)
+{
+	uint32_t cond = Field(opcode, 28, 4);
+	uint32_t op = Field(opcode, 21, 4);
+	unsigned rn = Field(opcode, 16, 4);
+	unsigned rd = Field(opcode, 12, 4);
+	uint32_t first = 0;
+	uint32_t result = 0;
+
+	if ((op >= DpTst) && (op <= DpCmn)) {
+		return;
+	}
+	bool known = operandKnown
+		&& ((op == DpMov) || (op == DpMvn) || ReadReg(ph, rn, addr, &first))
+		&& Compute(op, first, operand, &result);
+	Write(ph, cond, rd, known, result);
+}
+
+/**
+ * The register operand shifted by an immediate. RRX and the shifts by 32
+ * that an amount of 0 encodes for LSR/ASR need the flags or are rare.
+ */
+static bool ShiftedRegister(struct Peephole *ph, uint32_t addr, uint32_t opcode,
+		uint32_t *value)
+{
+	uint32_t amount = Field(opcode, 7, 5);
+	uint32_t x;
+
+	if (!ReadReg(ph, Field(opcode, 0, 4), addr, &x)) {
+		return false;
+	}
+	switch (Field(opcode, 5, 2)) {
+	case ShiftLsl:
+		*value = x << amount;
+		return true;
+	case ShiftLsr:
+		*value = x >> amount;
+		return amount != 0;
+	case ShiftAsr:
+		*value = (uint32_t)((int32_t)x >> amount);
+		return amount != 0;
+	default:
+		*value = Ror32(x, amount);
+		return amount != 0;
+	}
+}
+
+/**
+ * bits[27:25] = 000: data processing with a register, multiplies, the
+ * miscellaneous instructions and the extra loads and stores.
+ */
+static void StepClass0(struct Peephole *ph, uint32_t addr, uint32_t opcode)
+{
+	uint32_t cond = Field(opcode, 28, 4);
+	unsigned rn = Field(opcode, 16, 4);
+	unsigned rd = Field(opcode, 12, 4);
+	bool misc = (opcode & 0x01900000) == 0x01000000;
+
+	if ((opcode & 0x90) == 0x90) {
+		if ((opcode & 0x0F0000F0) == 0x00000090) {
+			/* MUL/MLA/MLS write RdHi (19:16), the long ones RdLo too */
+			Clobber(ph, cond, rn);
+			if ((opcode & 0x00800000) || ((opcode & 0x00F00000) == 0x00400000)) {
+				Clobber(ph, cond, rd);
+			}
+		}
+		else if ((opcode & 0x0F0000F0) == 0x01000090) {
+			/* SWP, LDREX, STREX (the status) */
+			Clobber(ph, cond, rd);
+		}
+		else {
+			/* LDRH, LDRSB, LDRSH, LDRD; STRH and STRD only write back */
+			bool load = opcode & 0x00100000;
+			bool ldrd = !load && ((opcode & 0x60) == 0x40);
+			if (!(opcode & 0x01000000) || (opcode & 0x00200000)) {
+				Clobber(ph, cond, rn);
+			}
+			if (load || ldrd) {
+				Clobber(ph, cond, rd);
+			}
+			if (ldrd) {
+				Clobber(ph, cond, (rd + 1) & 15);
+			}
+		}
+		return;
+	}
+
+	if (!misc) {
+		uint32_t operand = 0;
+		/* Shifts by a register are not followed */
+		bool known = !(opcode & 0x10) && ShiftedRegister(ph, addr, opcode, &operand);
+		StepDataProcessing(ph, addr, opcode, known, operand);
+		return;
+	}
+
+	if (((opcode & 0x0FFFFFF0) == 0x012FFF10) || ((opcode & 0x0FFFFFF0) == 0x012FFF20)) {
+		/* BX, BXJ */
+		Write(ph, cond, RegPc, false, 0);
+	}
+	else if (((opcode & 0x0FFFFFF0) == 0x012FFF30) || ((opcode & 0x0F9000F0) == 0x01000070)) {
+		/* BLX (register), BKPT, HVC, SMC */
+		ClobberCall(ph);
+	}
+	else if ((opcode & 0x0FB0FFF0) == 0x0120F000) {
+		/* MSR (register) only writes the status registers */
+	}
+	else if ((opcode & 0x0F900090) == 0x01000080) {
+		/* Halfword multiplies write 19:16, SMLALxy 15:12 as well */
+		ClobberData(ph, rn);
+		if (Field(opcode, 21, 2) == 2) {
+			ClobberData(ph, rd);
+		}
+	}
+	else {
+		/* MRS, CLZ, QADD and the like */
+		ClobberData(ph, rd);
+	}
+}
+
+/**
+ * bits[27:25] = 001: data processing with an immediate, MOVW, MOVT and
+ * MSR (immediate) along with the hints.
+ */
+static void StepClass1(struct Peephole *ph, uint32_t addr, uint32_t opcode)
+{
+	uint32_t cond = Field(opcode, 28, 4);
+	unsigned rd = Field(opcode, 12, 4);
+	uint32_t imm16 = (Field(opcode, 16, 4) << 12) | Field(opcode, 0, 12);
+	uint32_t value;
+
+	switch (opcode & 0x01F00000) {
+	case 0x01000000:
+		/* MOVW */
+		Write(ph, cond, rd, true, imm16);
+		return;
+	case 0x01400000:
+		/* MOVT keeps the low half */
+		if (PeepholeValue(ph, rd, &value)) {
+			Write(ph, cond, rd, true, (value & 0xffff) | (imm16 << 16));
+		}
+		else {
+			Clobber(ph, cond, rd);
+		}
+		return;
+	case 0x01200000:
+	case 0x01600000:
+		/* MSR (immediate), NOP, WFI and the other hints */
+		return;
+	default:
+		StepDataProcessing(ph, addr, opcode, true,
+				Ror32(Field(opcode, 0, 8), 2 * Field(opcode, 8, 4)));
+		return;
+	}
+}
+
+/**
+ * bits[27:26] = 01: LDR, STR, LDRB, STRB and the media instructions.
+ */
+static void StepLoadStore(struct Peephole *ph, uint32_t addr, uint32_t opcode)
+{
+	uint32_t cond = Field(opcode, 28, 4);
+	unsigned rn = Field(opcode, 16, 4);
+	unsigned rt = Field(opcode, 12, 4);
+	bool reg = opcode & 0x02000000;
+	bool pre = opcode & 0x01000000;
+	bool byte = opcode & 0x00400000;
+	bool writeBack = opcode & 0x00200000;
+	bool load = opcode & 0x00100000;
+
+	if (reg && (opcode & 0x10)) {
+		/* Media instructions write 15:12 or 19:16 */
+		ClobberData(ph, rn);
+		ClobberData(ph, rt);
+		return;
+	}
+	if (!pre || writeBack) {
+		Clobber(ph, cond, rn);
+	}
+	if (!load) {
+		return;
+	}
+
+	/* LDR Rt, [PC, #+/-imm12] */
+	uint32_t word = 0;
+	uint32_t literal = 0;
+	bool known = false;
+	bool isLiteral = (rn == RegPc) && !reg && pre && !writeBack && !byte;
+	if (isLiteral) {
+		uint32_t offset = Field(opcode, 0, 12);
+		uint32_t base = (addr + 8) & ~3u;
+		literal = (opcode & 0x00800000) ? (base + offset) : (base - offset);
+		known = ReadLiteral(ph, literal, &word);
+	}
+	Write(ph, cond, rt, known, word);
+	if (isLiteral && !known && (cond == CondAlways) && (rt != RegPc)) {
+		ph->pending |= 1u << rt;
+		ph->literals[rt] = literal;
+	}
+}
+
+/**
+ * bits[27:25] = 100: LDM and STM, including PUSH and POP.
+ */
+static void StepBlock(struct Peephole *ph, uint32_t opcode)
+{
+	uint32_t cond = Field(opcode, 28, 4);
+
+	if (opcode & 0x00200000) {
+		Clobber(ph, cond, Field(opcode, 16, 4));
+	}
+	if (!(opcode & 0x00100000)) {
+		return;
+	}
+	for (unsigned reg = 0; reg < 16; reg++) {
+		if (opcode & (1u << reg)) {
+			Clobber(ph, cond, reg);
+		}
+	}
+}
+
+/**
+ * bits[27:26] = 11: the coprocessor instructions and SVC.
+ */
+static void StepCoprocessor(struct Peephole *ph, uint32_t opcode)
+{
+	uint32_t cond = Field(opcode, 28, 4);
+	unsigned rn = Field(opcode, 16, 4);
+	unsigned rt = Field(opcode, 12, 4);
+
+	if ((opcode & 0x0F000000) == 0x0F000000) {
+		/* SVC */
+		ClobberCall(ph);
+	}
+	else if ((opcode & 0x0FF00000) == 0x0C500000) {
+		/* MRRC */
+		Clobber(ph, cond, rt);
+		Clobber(ph, cond, rn);
+	}
+	else if ((opcode & 0x0FE00000) == 0x0C400000) {
+		/* MCRR */
+	}
+	else if ((opcode & 0x0E000000) == 0x0C000000) {
+		/* LDC, STC with write-back */
+		if (!(opcode & 0x01000000) || (opcode & 0x00200000)) {
+			Clobber(ph, cond, rn);
+		}
+	}
+	else if ((opcode & 0x0F100010) == 0x0E100010) {
+		/* MRC; Rt = PC sets the flags */
+		ClobberData(ph, rt);
+	}
+}
+
+/**
+ * cond = 1111: BLX (immediate), RFE and SRS matter, the coprocessor
+ * instructions are as above and the rest (PLD, CPS, barriers) do not
+ * write core registers.
+ */
+static void StepUnconditional(struct Peephole *ph, uint32_t opcode)
+{
+	switch (Field(opcode, 25, 3)) {
+	case 4:
+		if ((opcode & 0x00500000) == 0x00100000) {
+			/* RFE */
+			PeepholeReset(ph);
+		}
+		else if ((opcode & 0x00700000) == 0x00600000) {
+			/* SRS with write-back */
+			ClobberData(ph, RegSp);
+		}
+		break;
+	case 5:
+		ClobberCall(ph);
+		break;
+	case 6:
+	case 7:
+		StepCoprocessor(ph, opcode);
+		break;
+	default:
+		break;
+	}
+}
+
+void PeepholeStep(struct Peephole *ph, uint32_t addr, uint32_t opcode)
+{
+	if (Field(opcode, 28, 4) == CondUnconditional) {
+		StepUnconditional(ph, opcode);
+		return;
+	}
+
+	switch (Field(opcode, 25, 3)) {
+	case 0:
+		StepClass0(ph, addr, opcode);
+		break;
+	case 1:
+		StepClass1(ph, addr, opcode);
+		break;
+	case 2:
+	case 3:
+		StepLoadStore(ph, addr, opcode);
+		break;
+	case 4:
+		StepBlock(ph, opcode);
+		break;
+	case 5:
+		/* B leaves the straight-line code, BL is a call */
+		if (opcode & 0x01000000) {
+			ClobberCall(ph);
+		}
+		else {
+			Write(ph, Field(opcode, 28, 4), RegPc, false, 0);
+		}
+		break;
+	default:
+		StepCoprocessor(ph, opcode);
+		break;
+	}
+}
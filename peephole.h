@@ -0,0 +1,122 @@
+#ifndef PEEPHOLE_H
+#define PEEPHOLE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * Peephole tracking of register values
+ *****************************************************************************/
+
+/*
+ * The tracker follows a stream of ARM instructions in address order and
+ * keeps the constant value of each core register where it can tell it,
+ * so that the value an MCR writes is known when the MCR comes up. It only
+ * looks at each instruction once: MOV, MVN, MOVW, MOVT, ORR, BIC, AND,
+ * EOR, ADD, SUB and RSB with known operands and literal loads define
+ * values, and everything else that may write a register forgets it.
+ * Calls forget the registers a callee may change; unconditional branches
+ * forget everything, as what follows them is reached from elsewhere.
+ *
+ * Literal loads are resolved from a ring of the most recent data words,
+ * which covers pools placed before the code, or else by the readLiteral
+ * hook, e.g. from a memory-mapped file. A register loaded from a word
+ * that neither has keeps the address of the word until it is written
+ * again, so that a caller streaming a listing can pick up the value when
+ * the pool after the code comes by.
+ */
+enum {
+	PEEPHOLE_RING_BITS = 8,
+	PEEPHOLE_RING_SIZE = 1 << PEEPHOLE_RING_BITS,
+};
+
+struct PeepholeWord {
+	/* Odd if the slot is empty, as words are aligned */
+	uint32_t addr;
+	uint32_t word;
+	/* The value of dataSeen when the word was stored */
+	uint32_t seq;
+};
+
+struct Peephole {
+	uint32_t values[16];
+	/* Bit r is set if values[r] holds the value of register r */
+	uint16_t known;
+	/* Bit r is set if register r holds the word at literals[r] */
+	uint16_t pending;
+	uint32_t literals[16];
+	/* Recent words, indexed by address */
+	struct PeepholeWord ring[PEEPHOLE_RING_SIZE];
+	uint32_t dataSeen;
+	bool (*readLiteral)(void *ctx, uint32_t addr, uint32_t *word);
+	void *ctx;
+	/*
+	 * Where the values came from, for callers that reuse results: the
+	 * lowest address a literal load looked at, the lowest seq of the ring
+	 * words literals were read from (0 for the hook), and whether the PC
+	 * was read, which ties the values to the address of the code. Callers
+	 * reset these as they see fit.
+	 */
+	uint32_t lowestLiteral;
+	uint32_t oldestLiteral;
+	bool readPc;
+};
+
+/**
+ * Start tracking with all registers unknown. readLiteral may be NULL.
+ */
+void PeepholeInit(struct Peephole *ph,
+		bool (*readLiteral)(void *ctx, uint32_t addr, uint32_t *word), void *ctx);
+
+/**
+ * Forget the values of all registers, e.g. at the start of a function.
+ */
+static inline void PeepholeReset(struct Peephole *ph)
+{
+	ph->known = 0;
+	ph->pending = 0;
+}
+
+/**
+ * Follow the ARM instruction at addr.
+ */
+void PeepholeStep(struct Peephole *ph, uint32_t addr, uint32_t opcode);
+
+/**
+ * Remember a data word at addr for the literal loads that follow.
+ */
+static inline void PeepholeData(struct Peephole *ph, uint32_t addr, uint32_t word)
+{
+	struct PeepholeWord *slot = &ph->ring[(addr >> 2) & (PEEPHOLE_RING_SIZE - 1)];
+	slot->addr = addr;
+	slot->word = word;
+	slot->seq = ++ph->dataSeen;
+}
+
+/**
+ * Get the value of register reg before the instruction that comes next.
+ */
+static inline bool PeepholeValue(const struct Peephole *ph, unsigned reg, uint32_t *value)
+{
+	if (!(ph->known & (1u << reg))) {
+		return false;
+	}
+	*value = ph->values[reg];
+	return true;
+}
+
+/**
+ * Get the address of the literal that register reg was loaded from, if
+ * its value is not known only because the word was not seen yet.
+ */
+static inline bool PeepholePendingLiteral(const struct Peephole *ph, unsigned reg,
+		uint32_t *addr)
+{
+	if (!(ph->pending & (1u << reg))) {
+		return false;
+	}
+	*addr = ph->literals[reg];
+	return true;
+}
+
+#endif /* PEEPHOLE_H */
@@ -0,0 +1,227 @@
+#include <stdbool.h>
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#include <immintrin.h>
+#endif
+
+#include "scan.h"
+
+#if defined(__AVX2__)
+typedef __m256i WordVector;
+#define WORDS_PER_VECTOR 8
+#define WordLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define WordSplat(x) _mm256_set1_epi32(x)
+#define WordMatch(v, mask, value) \
+	((uint32_t)_mm256_movemask_ps(_mm256_castsi256_ps( \
+		_mm256_cmpeq_epi32(_mm256_and_si256((v), (mask)), (value)))))
+#elif defined(__SSE2__)
+typedef __m128i WordVector;
+#define WORDS_PER_VECTOR 4
+#define WordLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define WordSplat(x) _mm_set1_epi32(x)
+#define WordMatch(v, mask, value) \
+	((uint32_t)_mm_movemask_ps(_mm_castsi128_ps( \
+		_mm_cmpeq_epi32(_mm_and_si128((v), (mask)), (value)))))
+#endif
+
+static inline uint32_t LoadWord(const uint8_t *p)
+{
+	uint32_t word;
+	memcpy(&word, p, sizeof(word));
+	return word;
+}
+
+size_t FindWordPattern(const uint8_t *p, size_t n, size_t from,
+		const struct WordPattern *pattern)
+{
+	size_t i = from;
+
+#ifdef WORDS_PER_VECTOR
+	const WordVector mask0 = WordSplat((int)pattern->mask[0]);
+	const WordVector value0 = WordSplat((int)pattern->value[0]);
+	const WordVector mask1 = WordSplat((int)pattern->mask[1]);
+	const WordVector value1 = WordSplat((int)pattern->value[1]);
+
+	/* Two vectors per step to keep both load ports busy */
+	for (; i + 2 * WORDS_PER_VECTOR <= n; i += 2 * WORDS_PER_VECTOR) {
+		const uint8_t *q = p + i * sizeof(uint32_t);
+		WordVector v = WordLoad(q);
+		WordVector w = WordLoad(q + WORDS_PER_VECTOR * sizeof(uint32_t));
+		uint32_t lo = WordMatch(v, mask0, value0) | WordMatch(v, mask1, value1);
+		uint32_t hi = WordMatch(w, mask0, value0) | WordMatch(w, mask1, value1);
+		uint32_t hits = lo | (hi << WORDS_PER_VECTOR);
+		if (hits) {
+			return i + __builtin_ctz(hits);
+		}
+	}
+#endif
+
+	for (; i < n; i++) {
+		uint32_t word = LoadWord(p + i * sizeof(uint32_t));
+		if (((word & pattern->mask[0]) == pattern->value[0])
+				|| ((word & pattern->mask[1]) == pattern->value[1])) {
+			return i;
+		}
+	}
+	return n;
+}
+
+#if defined(__AVX2__)
+typedef __m256i RawVector;
+#define RAW_BLOCK 32
+#define RAW_WORD_LANES 0x11111111u
+#define RAW_HALF_LANES 0x55555555u
+#define RawLoad(p) _mm256_loadu_si256((const __m256i *)(p))
+#define RawSplat32(x) _mm256_set1_epi32(x)
+#define RawSplat16(x) _mm256_set1_epi16(x)
+#define RawAnd(a, b) _mm256_and_si256((a), (b))
+#define RawOr(a, b) _mm256_or_si256((a), (b))
+#define RawEq32(v, mask, value) _mm256_cmpeq_epi32(_mm256_and_si256((v), (mask)), (value))
+#define RawEq16(v, mask, value) _mm256_cmpeq_epi16(_mm256_and_si256((v), (mask)), (value))
+#define RawBytes(v) ((uint32_t)_mm256_movemask_epi8(v))
+#elif defined(__SSE2__)
+typedef __m128i RawVector;
+#define RAW_BLOCK 16
+#define RAW_WORD_LANES 0x1111u
+#define RAW_HALF_LANES 0x5555u
+#define RawLoad(p) _mm_loadu_si128((const __m128i *)(p))
+#define RawSplat32(x) _mm_set1_epi32(x)
+#define RawSplat16(x) _mm_set1_epi16(x)
+#define RawAnd(a, b) _mm_and_si128((a), (b))
+#define RawOr(a, b) _mm_or_si128((a), (b))
+#define RawEq32(v, mask, value) _mm_cmpeq_epi32(_mm_and_si128((v), (mask)), (value))
+#define RawEq16(v, mask, value) _mm_cmpeq_epi16(_mm_and_si128((v), (mask)), (value))
+#define RawBytes(v) ((uint32_t)_mm_movemask_epi8(v))
+#endif
+
+static inline uint16_t LoadHalf(const uint8_t *p)
+{
+	uint16_t half;
+	memcpy(&half, p, sizeof(half));
+	return half;
+}
+
+/*
+ * The patterns are compared against the data loaded in host order, so
+ * each form is used as given and byte-swapped to cover both byte orders.
+ */
+enum {
+	RAW_VARIANTS = 2 * SCAN_FORMS,
+};
+
+struct RawVariants {
+	uint32_t wordMask[RAW_VARIANTS];
+	uint32_t wordValue[RAW_VARIANTS];
+	uint16_t firstMask[RAW_VARIANTS];
+	uint16_t firstValue[RAW_VARIANTS];
+	uint16_t secondMask[RAW_VARIANTS];
+	uint16_t secondValue[RAW_VARIANTS];
+};
+
+static void RawVariantsInit(struct RawVariants *rv, const struct RawPattern *pattern)
+{
+	for (int i = 0; i < SCAN_FORMS; i++) {
+		rv->wordMask[2 * i] = pattern->wordMask[i];
+		rv->wordMask[2 * i + 1] = __builtin_bswap32(pattern->wordMask[i]);
+		rv->wordValue[2 * i] = pattern->wordValue[i];
+		rv->wordValue[2 * i + 1] = __builtin_bswap32(pattern->wordValue[i]);
+		rv->firstMask[2 * i] = pattern->firstMask[i];
+		rv->firstMask[2 * i + 1] = __builtin_bswap16(pattern->firstMask[i]);
+		rv->firstValue[2 * i] = pattern->firstValue[i];
+		rv->firstValue[2 * i + 1] = __builtin_bswap16(pattern->firstValue[i]);
+		rv->secondMask[2 * i] = pattern->secondMask[i];
+		rv->secondMask[2 * i + 1] = __builtin_bswap16(pattern->secondMask[i]);
+		rv->secondValue[2 * i] = pattern->secondValue[i];
+		rv->secondValue[2 * i + 1] = __builtin_bswap16(pattern->secondValue[i]);
+	}
+}
+
+static bool RawScalarMatch(const struct RawVariants *rv, const uint8_t *p, size_t offset)
+{
+	uint32_t word = LoadWord(p + offset);
+	uint16_t first = LoadHalf(p + offset);
+	uint16_t second = LoadHalf(p + offset + 2);
+
+	for (int i = 0; i < RAW_VARIANTS; i++) {
+		if (!(offset & 3) && ((word & rv->wordMask[i]) == rv->wordValue[i])) {
+			return true;
+		}
+		if (((first & rv->firstMask[i]) == rv->firstValue[i])
+				&& ((second & rv->secondMask[i]) == rv->secondValue[i])) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void FindRawCandidates(const uint8_t *p, size_t size, size_t from, size_t to,
+		const struct RawPattern *pattern, RawCandidateFn fn, void *arg)
+{
+	struct RawVariants rv;
+	size_t i = (from + 1) & ~(size_t)1;
+
+	if (size < 4) {
+		return;
+	}
+	if (to > size - 3) {
+		to = size - 3;
+	}
+	RawVariantsInit(&rv, pattern);
+
+#ifdef RAW_BLOCK
+	RawVector wordMask[RAW_VARIANTS];
+	RawVector wordValue[RAW_VARIANTS];
+	RawVector firstMask[RAW_VARIANTS];
+	RawVector firstValue[RAW_VARIANTS];
+	RawVector secondMask[RAW_VARIANTS];
+	RawVector secondValue[RAW_VARIANTS];
+	for (int k = 0; k < RAW_VARIANTS; k++) {
+		wordMask[k] = RawSplat32((int)rv.wordMask[k]);
+		wordValue[k] = RawSplat32((int)rv.wordValue[k]);
+		firstMask[k] = RawSplat16((short)rv.firstMask[k]);
+		firstValue[k] = RawSplat16((short)rv.firstValue[k]);
+		secondMask[k] = RawSplat16((short)rv.secondMask[k]);
+		secondValue[k] = RawSplat16((short)rv.secondValue[k]);
+	}
+
+	/*
+	 * Each block is loaded twice, the second time one halfword further,
+	 * which lines up every halfword with the one following it. The byte
+	 * masks are thinned out to one bit per word or halfword offset.
+	 */
+	size_t block = i & ~(size_t)(RAW_BLOCK - 1);
+	uint32_t skip = ~0u << (i - block);
+	for (; (block < to) && (block + RAW_BLOCK + 2 <= size); block += RAW_BLOCK) {
+		RawVector v = RawLoad(p + block);
+		RawVector next = RawLoad(p + block + 2);
+		RawVector words = RawEq32(v, wordMask[0], wordValue[0]);
+		RawVector pairs = RawAnd(RawEq16(v, firstMask[0], firstValue[0]),
+				RawEq16(next, secondMask[0], secondValue[0]));
+		for (int k = 1; k < RAW_VARIANTS; k++) {
+			words = RawOr(words, RawEq32(v, wordMask[k], wordValue[k]));
+			pairs = RawOr(pairs, RawAnd(RawEq16(v, firstMask[k], firstValue[k]),
+						RawEq16(next, secondMask[k], secondValue[k])));
+		}
+		uint32_t hits = ((RawBytes(words) & RAW_WORD_LANES)
+				| (RawBytes(pairs) & RAW_HALF_LANES)) & skip;
+		for (; hits; hits &= hits - 1) {
+			size_t offset = block + __builtin_ctz(hits);
+			if (offset >= to) {
+				return;
+			}
+			fn(offset, arg);
+		}
+		skip = ~0u;
+	}
+	if (block > i) {
+		i = block;
+	}
+#endif
+
+	for (; i < to; i += 2) {
+		if (RawScalarMatch(&rv, p, i)) {
+			fn(i, arg);
+		}
+	}
+}
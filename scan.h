@@ -0,0 +1,80 @@
+#ifndef SCAN_H
+#define SCAN_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+/******************************************************************************
+ * Instruction pattern search
+ *****************************************************************************/
+
+/*
+ * Instructions are searched for in up to two forms at once, e.g. the
+ * MCR/MRC and the MCRR/MRRC encodings; a single form is given twice.
+ */
+enum {
+	SCAN_FORMS = 2,
+};
+
+/* (word & mask[i]) == value[i] for either form */
+struct WordPattern {
+	uint32_t mask[SCAN_FORMS];
+	uint32_t value[SCAN_FORMS];
+};
+
+/**
+ * Find the first of the n 32-bit words at p, starting from index 'from',
+ * that matches the pattern. The words are loaded in host byte order;
+ * search the other one with WordPatternSwap. p needs no particular
+ * alignment. Returns n if there is no match.
+ *
+ * Several words are tested per step with SSE2 or AVX2.
+ */
+size_t FindWordPattern(const uint8_t *p, size_t n, size_t from,
+		const struct WordPattern *pattern);
+
+static inline struct WordPattern WordPatternSwap(struct WordPattern pattern)
+{
+	for (int i = 0; i < SCAN_FORMS; i++) {
+		pattern.mask[i] = __builtin_bswap32(pattern.mask[i]);
+		pattern.value[i] = __builtin_bswap32(pattern.value[i]);
+	}
+	return pattern;
+}
+
+/*
+ * Raw blobs are searched for instructions in several encodings at once:
+ * 32-bit ARM words at every 4-byte aligned offset and pairs of Thumb
+ * halfwords at every 2-byte aligned offset, each in both byte orders.
+ * The patterns are given for little-endian data; the big-endian ones
+ * are derived from them.
+ */
+struct RawPattern {
+	/* (word & wordMask[i]) == wordValue[i] */
+	uint32_t wordMask[SCAN_FORMS];
+	uint32_t wordValue[SCAN_FORMS];
+	/*
+	 * (first & firstMask[i]) == firstValue[i]
+	 * && (second & secondMask[i]) == secondValue[i]
+	 */
+	uint16_t firstMask[SCAN_FORMS];
+	uint16_t firstValue[SCAN_FORMS];
+	uint16_t secondMask[SCAN_FORMS];
+	uint16_t secondValue[SCAN_FORMS];
+};
+
+typedef void (*RawCandidateFn)(size_t offset, void *arg);
+
+/**
+ * Call fn for every even offset in [from, to) of the size bytes at p
+ * where any of the encodings may match in either form, in increasing
+ * order. Offsets are relative to p, which is the 4-byte aligned
+ * reference for ARM words; the bytes up to size may be read past 'to'.
+ * The caller has to check which encodings actually match. A 16- or
+ * 32-byte block is tested per step with SSE2 or AVX2, and the patterns
+ * are set up once for the whole range.
+ */
+void FindRawCandidates(const uint8_t *p, size_t size, size_t from, size_t to,
+		const struct RawPattern *pattern, RawCandidateFn fn, void *arg);
+
+#endif /* SCAN_H */
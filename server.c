@@ -0,0 +1,405 @@
+#define _GNU_SOURCE
+
+#include <endian.h>
+#include <errno.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "server.h"
+
+enum {
+	SERVER_MAX_EVENTS = 64,
+	/* Room made in the input buffer for each read */
+	SERVER_READ_SIZE = 64 << 10,
+	SERVER_MIN_BUFFER = 4 << 10,
+};
+
+/*
+ * The bytes in [start, size) are still to be consumed. The buffer is only
+ * compacted when it would have to grow otherwise.
+ */
+struct Buffer {
+	char *data;
+	size_t start;
+	size_t size;
+	size_t capacity;
+};
+
+struct Client {
+	int fd;
+	/* The events the client is registered for */
+	uint32_t events;
+	/* The client has shut down its side; answer and close */
+	bool eof;
+	struct Buffer in;
+	struct Buffer out;
+	struct Client *prev;
+	struct Client *next;
+};
+
+struct Server {
+	int epoll;
+	int listener;
+	ServerHandler handler;
+	void *arg;
+	/* Each response is collected here, then framed into the client buffer */
+	struct Output response;
+	struct Client *clients;
+};
+
+static volatile sig_atomic_t ServerStopping;
+
+static void StopServer(int sig)
+{
+	(void)sig;
+	ServerStopping = 1;
+}
+
+static inline uint32_t LoadLe32(const char *p)
+{
+	uint32_t val;
+	memcpy(&val, p, sizeof(val));
+	return le32toh(val);
+}
+
+static inline void StoreLe32(char *p, uint32_t val)
+{
+	val = htole32(val);
+	memcpy(p, &val, sizeof(val));
+}
+
+static inline size_t BufferLength(const struct Buffer *buf)
+{
+	return buf->size - buf->start;
+}
+
+static void BufferReserve(struct Buffer *buf, size_t length)
+{
+	if (buf->size + length <= buf->capacity) {
+		return;
+	}
+	if (buf->start) {
+		memmove(buf->data, buf->data + buf->start, buf->size - buf->start);
+		buf->size -= buf->start;
+		buf->start = 0;
+	}
+	if (buf->size + length > buf->capacity) {
+		size_t capacity = buf->capacity ? buf->capacity : SERVER_MIN_BUFFER;
+		while (capacity < buf->size + length) {
+			capacity *= 2;
+		}
+		char *data = realloc(buf->data, capacity);
+		if (!data) {
+			perror("realloc");
+			exit(1);
+		}
+		buf->data = data;
+		buf->capacity = capacity;
+	}
+}
+
+static inline void BufferConsume(struct Buffer *buf, size_t length)
+{
+	buf->start += length;
+	if (buf->start == buf->size) {
+		buf->start = 0;
+		buf->size = 0;
+	}
+}
+
+static void CloseClient(struct Server *server, struct Client *client)
+{
+	if (client->prev) {
+		client->prev->next = client->next;
+	}
+	else {
+		server->clients = client->next;
+	}
+	if (client->next) {
+		client->next->prev = client->prev;
+	}
+	close(client->fd);
+	free(client->in.data);
+	free(client->out.data);
+	free(client);
+}
+
+/**
+ * Read once from the client, which is enough as the event comes again
+ * while there is more. Returns false if the connection is broken.
+ */
+static bool ClientRead(struct Client *client)
+{
+	BufferReserve(&client->in, SERVER_READ_SIZE);
+	for (;;) {
+		ssize_t ret = read(client->fd, client->in.data + client->in.size,
+				client->in.capacity - client->in.size);
+		if (ret > 0) {
+			client->in.size += ret;
+			return true;
+		}
+		if (!ret) {
+			client->eof = true;
+			return true;
+		}
+		if (errno != EINTR) {
+			return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+		}
+	}
+}
+
+/**
+ * Send as much of the queued responses as the socket takes. Returns
+ * false if the connection is broken.
+ */
+static bool ClientWrite(struct Client *client)
+{
+	while (BufferLength(&client->out)) {
+		ssize_t ret = send(client->fd, client->out.data + client->out.start,
+				BufferLength(&client->out), MSG_NOSIGNAL);
+		if (ret > 0) {
+			BufferConsume(&client->out, ret);
+		}
+		else if ((ret < 0) && (errno != EINTR)) {
+			return (errno == EAGAIN) || (errno == EWOULDBLOCK);
+		}
+	}
+	return true;
+}
+
+/**
+ * Answer the complete requests received so far, as long as the client
+ * keeps up with reading the responses. Returns false if a request is
+ * too long to be valid.
+ */
+static bool ServeRequests(struct Server *server, struct Client *client)
+{
+	while (BufferLength(&client->out) < SERVER_MAX_PENDING) {
+		const char *p = client->in.data + client->in.start;
+		size_t available = BufferLength(&client->in);
+
+		if (available < SERVER_HEADER_SIZE) {
+			break;
+		}
+		uint32_t length = LoadLe32(p);
+		if (length > SERVER_MAX_PAYLOAD) {
+			return false;
+		}
+		if (available - SERVER_HEADER_SIZE < length) {
+			break;
+		}
+
+		uint32_t status = server->handler(&server->response, LoadLe32(p + 4),
+				p + SERVER_HEADER_SIZE, length, server->arg);
+		size_t responseLength = server->response.pending;
+		BufferReserve(&client->out, SERVER_HEADER_SIZE + responseLength);
+		char *dst = client->out.data + client->out.size;
+		StoreLe32(dst, responseLength);
+		StoreLe32(dst + 4, status);
+		OutputGather(&server->response, dst + SERVER_HEADER_SIZE);
+		client->out.size += SERVER_HEADER_SIZE + responseLength;
+		BufferConsume(&client->in, SERVER_HEADER_SIZE + length);
+	}
+	return true;
+}
+
+/**
+ * Whether a whole request is waiting in the input of the client.
+ */
+static bool HasRequest(const struct Client *client)
+{
+	size_t available = BufferLength(&client->in);
+
+	return (available >= SERVER_HEADER_SIZE)
+		&& (available - SERVER_HEADER_SIZE >= LoadLe32(client->in.data + client->in.start));
+}
+
+static void ClientEvent(struct Server *server, struct Client *client, uint32_t events)
+{
+	bool ok = true;
+
+	if ((events & (EPOLLIN | EPOLLHUP | EPOLLERR)) && !client->eof) {
+		ok = ClientRead(client);
+	}
+	ok = ok && ServeRequests(server, client) && ClientWrite(client);
+	/*
+	 * Serving stops at the limit of pending output. If the socket took it
+	 * all, no event comes for the requests left, which after EOF would
+	 * also close the connection before they are answered.
+	 */
+	while (ok && !BufferLength(&client->out) && HasRequest(client)) {
+		ok = ServeRequests(server, client) && ClientWrite(client);
+	}
+	if (!ok || (client->eof && !BufferLength(&client->out))) {
+		CloseClient(server, client);
+		return;
+	}
+
+	uint32_t wanted = 0;
+	if (!client->eof && (BufferLength(&client->out) < SERVER_MAX_PENDING)) {
+		wanted |= EPOLLIN;
+	}
+	if (BufferLength(&client->out)) {
+		wanted |= EPOLLOUT;
+	}
+	if (wanted != client->events) {
+		struct epoll_event ev = { .events = wanted, .data.ptr = client };
+		if (epoll_ctl(server->epoll, EPOLL_CTL_MOD, client->fd, &ev)) {
+			CloseClient(server, client);
+			return;
+		}
+		client->events = wanted;
+	}
+}
+
+static void AcceptClients(struct Server *server)
+{
+	for (;;) {
+		int fd = accept4(server->listener, NULL, NULL, SOCK_NONBLOCK | SOCK_CLOEXEC);
+		if (fd < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			if ((errno != EAGAIN) && (errno != EWOULDBLOCK)) {
+				perror("accept");
+			}
+			return;
+		}
+
+		struct Client *client = calloc(1, sizeof(*client));
+		if (!client) {
+			close(fd);
+			continue;
+		}
+		client->fd = fd;
+		client->events = EPOLLIN;
+
+		struct epoll_event ev = { .events = EPOLLIN, .data.ptr = client };
+		if (epoll_ctl(server->epoll, EPOLL_CTL_ADD, fd, &ev)) {
+			perror("epoll_ctl");
+			close(fd);
+			free(client);
+			continue;
+		}
+		client->next = server->clients;
+		if (client->next) {
+			client->next->prev = client;
+		}
+		server->clients = client;
+	}
+}
+
+/**
+ * Create the listening socket. A socket file that nobody accepts on any
+ * more is left over from a previous server and gets replaced.
+ */
+static int Listen(const char *path)
+{
+	struct sockaddr_un addr = { .sun_family = AF_UNIX };
+	struct stat st;
+	size_t length = strlen(path);
+
+	if (length >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "%s: socket path too long\n", path);
+		return -1;
+	}
+	memcpy(addr.sun_path, path, length + 1);
+
+	if (!lstat(path, &st) && S_ISSOCK(st.st_mode)) {
+		int probe = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+		bool live = (probe >= 0) && !connect(probe, (struct sockaddr *)&addr, sizeof(addr));
+		if (probe >= 0) {
+			close(probe);
+		}
+		if (live) {
+			fprintf(stderr, "%s: a server is already running\n", path);
+			return -1;
+		}
+		unlink(path);
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		perror("socket");
+		return -1;
+	}
+	if (bind(fd, (struct sockaddr *)&addr, sizeof(addr)) || listen(fd, SOMAXCONN)) {
+		perror(path);
+		close(fd);
+		return -1;
+	}
+	return fd;
+}
+
+bool RunServer(const char *path, ServerHandler handler, void *arg)
+{
+	struct Server server = {
+		.handler = handler,
+		.arg = arg,
+	};
+	struct epoll_event events[SERVER_MAX_EVENTS];
+	struct sigaction action = { .sa_handler = StopServer };
+	sigset_t stopSignals;
+	sigset_t waitMask;
+	bool ok = true;
+
+	server.listener = Listen(path);
+	if (server.listener < 0) {
+		return false;
+	}
+	server.epoll = epoll_create1(EPOLL_CLOEXEC);
+	struct epoll_event ev = { .events = EPOLLIN, .data.ptr = NULL };
+	if ((server.epoll < 0) || epoll_ctl(server.epoll, EPOLL_CTL_ADD, server.listener, &ev)) {
+		perror("epoll");
+		close(server.listener);
+		unlink(path);
+		return false;
+	}
+	OutputInitBuffer(&server.response);
+
+	/* The signals are only let in while waiting, so none is missed */
+	sigemptyset(&stopSignals);
+	sigaddset(&stopSignals, SIGINT);
+	sigaddset(&stopSignals, SIGTERM);
+	sigprocmask(SIG_BLOCK, &stopSignals, &waitMask);
+	sigdelset(&waitMask, SIGINT);
+	sigdelset(&waitMask, SIGTERM);
+	sigaction(SIGINT, &action, NULL);
+	sigaction(SIGTERM, &action, NULL);
+
+	while (!ServerStopping) {
+		int count = epoll_pwait(server.epoll, events, SERVER_MAX_EVENTS, -1, &waitMask);
+		if (count < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			perror("epoll_wait");
+			ok = false;
+			break;
+		}
+		for (int i = 0; i < count; i++) {
+			if (events[i].data.ptr) {
+				ClientEvent(&server, events[i].data.ptr, events[i].events);
+			}
+			else {
+				AcceptClients(&server);
+			}
+		}
+	}
+
+	while (server.clients) {
+		CloseClient(&server, server.clients);
+	}
+	OutputFree(&server.response);
+	close(server.epoll);
+	close(server.listener);
+	unlink(path);
+	return ok;
+}
@@ -0,0 +1,45 @@
+#ifndef SERVER_H
+#define SERVER_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#include "output.h"
+
+/******************************************************************************
+ * Request server on a Unix domain socket
+ *****************************************************************************/
+
+/*
+ * Clients connect to a stream socket and send requests, each answered by
+ * a response in the same order. Both are frames with an 8-byte header of
+ * two little-endian 32-bit words followed by the payload:
+ *   request:  length, kind,   payload[length]
+ *   response: length, status, payload[length]
+ * A single thread serves all the clients from an epoll loop. A client
+ * that sends a frame longer than SERVER_MAX_PAYLOAD is disconnected, and
+ * one that does not read its responses is not read from until it does.
+ */
+enum {
+	SERVER_HEADER_SIZE = 8,
+	SERVER_MAX_PAYLOAD = 16 << 20,
+	/* Responses queued for a client before its requests are left unread */
+	SERVER_MAX_PENDING = 16 << 20,
+};
+
+/**
+ * Write the response to a request into out and return its status. The
+ * payload stays valid until the response has been taken from out.
+ */
+typedef uint32_t (*ServerHandler)(struct Output *out, uint32_t kind,
+		const char *payload, size_t length, void *arg);
+
+/**
+ * Serve requests on a socket created at path until SIGINT or SIGTERM. A
+ * stale socket left at path is replaced. Returns false if the socket
+ * cannot be set up.
+ */
+bool RunServer(const char *path, ServerHandler handler, void *arg);
+
+#endif /* SERVER_H */
@@ -0,0 +1,310 @@
+#define _GNU_SOURCE
+
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "libarmcopro.h"
+#include "mcr_encoding.h"
+#include "stats.h"
+
+enum {
+	STATS_MIN_SLOTS = 64,
+	/* Registers listed in the histogram */
+	STATS_TOP_REGISTERS = 10,
+};
+
+bool StatsOn;
+__thread struct StatsBlock *ThreadStats;
+
+static struct StatsBlock *StatsBlocks;
+static uint64_t StartTicks;
+static double StartSeconds;
+
+static double Now(void)
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+static void *CallocOrDie(size_t count, size_t size)
+{
+	void *ret = calloc(count, size);
+	if (!ret) {
+		perror("calloc");
+		exit(1);
+	}
+	return ret;
+}
+
+struct StatsBlock *StatsBlockNew(void)
+{
+	struct StatsBlock *block = CallocOrDie(1, sizeof(*block));
+
+	block->next = __atomic_load_n(&StatsBlocks, __ATOMIC_RELAXED);
+	while (!__atomic_compare_exchange_n(&StatsBlocks, &block->next, block,
+				true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+	}
+	return ThreadStats = block;
+}
+
+void StatsEnable(void)
+{
+	StartSeconds = Now();
+	StartTicks = StatsTicks();
+	StatsOn = true;
+}
+
+/******************************************************************************
+ * Histogram
+ *****************************************************************************/
+
+static inline uint32_t HistogramHash(uint32_t key)
+{
+	uint32_t hash = key * 0x9e3779b1u;
+	return hash ^ (hash >> 16);
+}
+
+static struct StatsHistogramSlot *HistogramSlot(struct StatsBlock *block, uint32_t key)
+{
+	size_t mask = block->numSlots - 1;
+	size_t i = HistogramHash(key) & mask;
+
+	while (block->slots[i].key && (block->slots[i].key != key)) {
+		i = (i + 1) & mask;
+	}
+	return &block->slots[i];
+}
+
+static void HistogramCount(struct StatsBlock *block, uint32_t key, uint64_t count)
+{
+	if (2 * (block->numKeys + 1) > block->numSlots) {
+		struct StatsHistogramSlot *old = block->slots;
+		size_t numOld = block->numSlots;
+
+		block->numSlots = numOld ? (2 * numOld) : STATS_MIN_SLOTS;
+		block->slots = CallocOrDie(block->numSlots, sizeof(block->slots[0]));
+		for (size_t i = 0; i < numOld; i++) {
+			if (old[i].key) {
+				*HistogramSlot(block, old[i].key) = old[i];
+			}
+		}
+		free(old);
+	}
+
+	struct StatsHistogramSlot *slot = HistogramSlot(block, key);
+	if (!slot->key) {
+		slot->key = key;
+		block->numKeys++;
+	}
+	slot->count += count;
+}
+
+void StatsHistogramAdd(struct StatsBlock *block, uint32_t opcode)
+{
+	HistogramCount(block, CoproAccessKey(opcode), 1);
+}
+
+/******************************************************************************
+ * Report
+ *****************************************************************************/
+
+struct StatsRegister {
+	const char *name;
+	uint64_t reads;
+	uint64_t writes;
+};
+
+struct StatsReport {
+	uint64_t counters[StatCounters];
+	uint64_t ticks[StatPhases];
+	unsigned threads;
+	double wallSeconds;
+	double ticksPerSecond;
+	uint64_t unknown;
+	struct StatsRegister *regs;
+	size_t numRegs;
+};
+
+static int CompareRegisters(const void *a, const void *b)
+{
+	const struct StatsRegister *x = a;
+	const struct StatsRegister *y = b;
+	uint64_t xCount = x->reads + x->writes;
+	uint64_t yCount = y->reads + y->writes;
+
+	if (xCount != yCount) {
+		return (xCount < yCount) ? 1 : -1;
+	}
+	return strcmp(x->name, y->name);
+}
+
+static void AddRegister(struct StatsReport *report, const char *name, bool mrc, uint64_t count)
+{
+	size_t i = 0;
+
+	while ((i < report->numRegs) && strcmp(report->regs[i].name, name)) {
+		i++;
+	}
+	if (i == report->numRegs) {
+		report->regs[report->numRegs++] = (struct StatsRegister) { .name = name };
+	}
+	*(mrc ? &report->regs[i].reads : &report->regs[i].writes) += count;
+}
+
+/**
+ * Sum up the blocks of all threads and look up the registers of the
+ * encodings in the histogram. Variants of a register under the same
+ * name are counted once.
+ */
+static void CollectReport(struct StatsReport *report, uint32_t isa)
+{
+	struct StatsBlock merged;
+
+	memset(report, 0, sizeof(*report));
+	memset(&merged, 0, sizeof(merged));
+	for (struct StatsBlock *block = __atomic_load_n(&StatsBlocks, __ATOMIC_ACQUIRE);
+			block; block = block->next) {
+		for (size_t i = 0; i < StatCounters; i++) {
+			report->counters[i] += block->counters[i];
+		}
+		for (size_t i = 0; i < StatPhases; i++) {
+			report->ticks[i] += block->ticks[i];
+		}
+		for (size_t i = 0; i < block->numSlots; i++) {
+			if (block->slots[i].key) {
+				HistogramCount(&merged, block->slots[i].key, block->slots[i].count);
+			}
+		}
+		report->threads++;
+	}
+
+	report->wallSeconds = Now() - StartSeconds;
+	report->ticksPerSecond = (report->wallSeconds > 0)
+		? ((StatsTicks() - StartTicks) / report->wallSeconds) : 1.0;
+
+	report->regs = CallocOrDie(ArmCoproRegCount() + 1, sizeof(report->regs[0]));
+	for (size_t i = 0; i < merged.numSlots; i++) {
+		const struct StatsHistogramSlot *slot = &merged.slots[i];
+		struct ArmCoproInsn insn;
+
+		if (!slot->key) {
+			continue;
+		}
+		ArmCoproDecode(slot->key, isa, &insn);
+		if (!insn.numRegs) {
+			report->unknown += slot->count;
+		}
+		for (size_t j = 0; j < insn.numRegs; j++) {
+			const char *name = insn.regs[j].name ? insn.regs[j].name : "Unknown";
+			bool seen = false;
+			for (size_t k = 0; k < j; k++) {
+				const char *other = insn.regs[k].name ? insn.regs[k].name : "Unknown";
+				seen |= !strcmp(name, other);
+			}
+			if (!seen) {
+				AddRegister(report, name, insn.mrc, slot->count);
+			}
+		}
+	}
+	qsort(report->regs, report->numRegs, sizeof(report->regs[0]), CompareRegisters);
+	if (report->numRegs > STATS_TOP_REGISTERS) {
+		report->numRegs = STATS_TOP_REGISTERS;
+	}
+	free(merged.slots);
+}
+
+static const char *const PhaseNames[StatPhases] = {
+	[PhaseRead] = "read",
+	[PhaseParse] = "parse",
+	[PhaseDecode] = "decode",
+	[PhaseWrite] = "write",
+};
+
+static void PrintText(FILE *file, const struct StatsReport *report)
+{
+	const uint64_t *c = report->counters;
+	uint64_t probes = c[StatCacheProbes];
+
+	fprintf(file, "lines: %llu, %llu bytes (%.1f MB/s)\n",
+			(unsigned long long)c[StatLines], (unsigned long long)c[StatBytes],
+			(report->wallSeconds > 0) ? (c[StatBytes] / report->wallSeconds / 1e6) : 0.0);
+	fprintf(file, "accesses: %llu MCR/MRC and MCRR/MRRC, %llu to unknown registers\n",
+			(unsigned long long)c[StatAccesses], (unsigned long long)report->unknown);
+	fprintf(file, "probes: %llu annotation cache (%.1f%% hits), %llu register database\n",
+			(unsigned long long)probes, probes ? (100.0 * c[StatCacheHits] / probes) : 0.0,
+			(unsigned long long)c[StatDecodes]);
+	fprintf(file, "time: %.3fs wall, %u thread%s;", report->wallSeconds, report->threads,
+			(report->threads == 1) ? "" : "s");
+	for (size_t i = 0; i < StatPhases; i++) {
+		fprintf(file, " %s %.3fs%s", PhaseNames[i], report->ticks[i] / report->ticksPerSecond,
+				(i + 1 < StatPhases) ? "," : "\n");
+	}
+	if (report->numRegs) {
+		fprintf(file, "registers:\n");
+	}
+	for (size_t i = 0; i < report->numRegs; i++) {
+		const struct StatsRegister *reg = &report->regs[i];
+		fprintf(file, "  %-16s %10llu  (%llu MRC, %llu MCR)\n", reg->name,
+				(unsigned long long)(reg->reads + reg->writes),
+				(unsigned long long)reg->reads, (unsigned long long)reg->writes);
+	}
+}
+
+static void PrintJsonString(FILE *file, const char *s)
+{
+	fputc('"', file);
+	for (; *s; s++) {
+		if ((*s == '"') || (*s == '\\')) {
+			fputc('\\', file);
+		}
+		if ((unsigned char)*s < 0x20) {
+			fprintf(file, "\\u%04x", *s);
+		}
+		else {
+			fputc(*s, file);
+		}
+	}
+	fputc('"', file);
+}
+
+static void PrintJson(FILE *file, const struct StatsReport *report)
+{
+	const uint64_t *c = report->counters;
+
+	fprintf(file, "{\"lines\":%llu,\"bytes\":%llu,\"accesses\":%llu,\"unknown\":%llu,"
+			"\"cache_probes\":%llu,\"cache_hits\":%llu,\"decodes\":%llu,",
+			(unsigned long long)c[StatLines], (unsigned long long)c[StatBytes],
+			(unsigned long long)c[StatAccesses], (unsigned long long)report->unknown,
+			(unsigned long long)c[StatCacheProbes], (unsigned long long)c[StatCacheHits],
+			(unsigned long long)c[StatDecodes]);
+	fprintf(file, "\"threads\":%u,\"seconds\":{\"wall\":%.6f", report->threads,
+			report->wallSeconds);
+	for (size_t i = 0; i < StatPhases; i++) {
+		fprintf(file, ",\"%s\":%.6f", PhaseNames[i], report->ticks[i] / report->ticksPerSecond);
+	}
+	fprintf(file, "},\"registers\":[");
+	for (size_t i = 0; i < report->numRegs; i++) {
+		const struct StatsRegister *reg = &report->regs[i];
+		fprintf(file, "%s{\"name\":", i ? "," : "");
+		PrintJsonString(file, reg->name);
+		fprintf(file, ",\"reads\":%llu,\"writes\":%llu}",
+				(unsigned long long)reg->reads, (unsigned long long)reg->writes);
+	}
+	fprintf(file, "]}\n");
+}
+
+void StatsPrint(FILE *file, enum StatsFormat format, uint32_t isa)
+{
+	struct StatsReport report;
+
+	CollectReport(&report, isa);
+	if (format == StatsJson) {
+		PrintJson(file, &report);
+	}
+	else {
+		PrintText(file, &report);
+	}
+	free(report.regs);
+}
@@ -0,0 +1,215 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+/******************************************************************************
+ * Run statistics
+ *****************************************************************************/
+
+/*
+ * With --stats the decoders count what they see and time the phases of
+ * the run. Each thread counts into a block of its own, so the hot loops
+ * never touch shared memory; the blocks are chained together and summed
+ * up at exit. The timers read the TSC where there is one and are only
+ * taken around system calls and decoded instructions, never per line.
+ *
+ * Without WITH_STATS the functions below are empty and the calls compile
+ * away altogether.
+ */
+enum StatsCounter {
+	StatLines,
+	StatBytes,
+	StatAccesses,
+	StatCacheProbes,
+	StatCacheHits,
+	/* Lookups in the register database */
+	StatDecodes,
+	StatCounters
+};
+
+enum StatsPhase {
+	/* Waiting for input */
+	PhaseRead,
+	/* Splitting and parsing lines, and everything else in the loops */
+	PhaseParse,
+	/* Decoding and formatting the annotations of accesses */
+	PhaseDecode,
+	/* Writing the output */
+	PhaseWrite,
+	StatPhases
+};
+
+enum StatsFormat {
+	StatsText,
+	StatsJson,
+};
+
+#ifdef WITH_STATS
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <time.h>
+#endif
+
+struct StatsHistogramSlot {
+	/* The opcode without condition and Rd, 0 if the slot is empty */
+	uint32_t key;
+	uint64_t count;
+};
+
+struct StatsBlock {
+	uint64_t counters[StatCounters];
+	uint64_t ticks[StatPhases];
+	/* Accesses per encoding, open addressing */
+	struct StatsHistogramSlot *slots;
+	size_t numSlots;
+	size_t numKeys;
+	struct StatsBlock *next;
+};
+
+extern bool StatsOn;
+extern __thread struct StatsBlock *ThreadStats;
+
+struct StatsBlock *StatsBlockNew(void);
+void StatsHistogramAdd(struct StatsBlock *block, uint32_t opcode);
+
+static inline struct StatsBlock *StatsBlockGet(void)
+{
+	struct StatsBlock *block = ThreadStats;
+	return block ? block : StatsBlockNew();
+}
+
+static inline uint64_t StatsTicks(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	return __rdtsc();
+#else
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000u + ts.tv_nsec;
+#endif
+}
+
+static inline void StatsAdd(enum StatsCounter counter, uint64_t n)
+{
+	if (StatsOn) {
+		StatsBlockGet()->counters[counter] += n;
+	}
+}
+
+/**
+ * Count a coprocessor access for the histogram of registers.
+ */
+static inline void StatsAccess(uint32_t opcode)
+{
+	if (StatsOn) {
+		struct StatsBlock *block = StatsBlockGet();
+		block->counters[StatAccesses]++;
+		StatsHistogramAdd(block, opcode);
+	}
+}
+
+/**
+ * Time a phase: StatsStop(phase, StatsStart()).
+ */
+static inline uint64_t StatsStart(void)
+{
+	return StatsOn ? StatsTicks() : 0;
+}
+
+static inline void StatsStop(enum StatsPhase phase, uint64_t start)
+{
+	if (StatsOn) {
+		StatsBlockGet()->ticks[phase] += StatsTicks() - start;
+	}
+}
+
+/*
+ * The time of a decoding loop that is not spent in the other phases is
+ * put down as parsing.
+ */
+struct StatsLoop {
+	uint64_t start;
+	uint64_t other;
+};
+
+static inline void StatsLoopStart(struct StatsLoop *loop)
+{
+	loop->start = 0;
+	loop->other = 0;
+	if (StatsOn) {
+		const struct StatsBlock *block = StatsBlockGet();
+		loop->other = block->ticks[PhaseRead] + block->ticks[PhaseDecode]
+			+ block->ticks[PhaseWrite];
+		loop->start = StatsTicks();
+	}
+}
+
+static inline void StatsLoopStop(const struct StatsLoop *loop)
+{
+	if (StatsOn) {
+		uint64_t elapsed = StatsTicks() - loop->start;
+		struct StatsBlock *block = StatsBlockGet();
+		uint64_t other = block->ticks[PhaseRead] + block->ticks[PhaseDecode]
+			+ block->ticks[PhaseWrite] - loop->other;
+		block->ticks[PhaseParse] += (elapsed > other) ? (elapsed - other) : 0;
+	}
+}
+
+/**
+ * Start counting; the wall time of the run is taken from here.
+ */
+void StatsEnable(void);
+
+/**
+ * Print the sums of all threads to file. The registers of the histogram
+ * are looked up for the ISA revisions in isa.
+ */
+void StatsPrint(FILE *file, enum StatsFormat format, uint32_t isa);
+
+#else /* WITH_STATS */
+
+struct StatsLoop {
+	char unused;
+};
+
+static inline void StatsAdd(enum StatsCounter counter, uint64_t n)
+{
+	(void)counter;
+	(void)n;
+}
+
+static inline void StatsAccess(uint32_t opcode)
+{
+	(void)opcode;
+}
+
+static inline uint64_t StatsStart(void)
+{
+	return 0;
+}
+
+static inline void StatsStop(enum StatsPhase phase, uint64_t start)
+{
+	(void)phase;
+	(void)start;
+}
+
+static inline void StatsLoopStart(struct StatsLoop *loop)
+{
+	(void)loop;
+}
+
+static inline void StatsLoopStop(const struct StatsLoop *loop)
+{
+	(void)loop;
+}
+
+#endif /* WITH_STATS */
+
+#endif /* STATS_H */
@@ -0,0 +1,527 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "libarmcopro.h"
+#include "mcr_encoding.h"
+#include "summary.h"
+
+enum {
+	SUMMARY_MIN_HITS = 256,
+	SUMMARY_MIN_GROUPS = 64,
+	SUMMARY_MIN_SLOTS = 128,
+	SUMMARY_MIN_NAMES = 4 << 10,
+	/* Addresses formatted per reservation of output */
+	SUMMARY_ADDRESS_BATCH = 256,
+};
+
+static void *ReallocOrDie(void *ptr, size_t size)
+{
+	void *ret = realloc(ptr, size);
+	if (!ret) {
+		perror("realloc");
+		exit(1);
+	}
+	return ret;
+}
+
+/**
+ * Make room for needed elements, doubling the capacity.
+ */
+static void *Grow(void *array, size_t *capacity, size_t needed, size_t elementSize,
+		size_t minimum)
+{
+	size_t newCapacity = *capacity ? *capacity : minimum;
+
+	if (needed <= *capacity) {
+		return array;
+	}
+	while (newCapacity < needed) {
+		newCapacity *= 2;
+	}
+	*capacity = newCapacity;
+	return ReallocOrDie(array, newCapacity * elementSize);
+}
+
+/******************************************************************************
+ * Names
+ *****************************************************************************/
+
+static inline uint32_t NameHash(const char *name, size_t length)
+{
+	uint32_t hash = 2166136261u;
+
+	for (size_t i = 0; i < length; i++) {
+		hash = (hash ^ (uint8_t)name[i]) * 16777619u;
+	}
+	return hash;
+}
+
+static inline const char *NameGet(const struct SummaryNames *names, uint32_t number)
+{
+	return names->chars + names->offsets[number];
+}
+
+static void RehashNames(struct SummaryNames *names)
+{
+	size_t numSlots = names->numSlots ? (2 * names->numSlots) : SUMMARY_MIN_SLOTS;
+	uint32_t *slots = calloc(numSlots, sizeof(*slots));
+
+	if (!slots) {
+		perror("calloc");
+		exit(1);
+	}
+	for (size_t i = 0; i < names->count; i++) {
+		const char *name = NameGet(names, i);
+		size_t j = NameHash(name, strlen(name)) & (numSlots - 1);
+		while (slots[j]) {
+			j = (j + 1) & (numSlots - 1);
+		}
+		slots[j] = i + 1;
+	}
+	free(names->slots);
+	names->slots = slots;
+	names->numSlots = numSlots;
+}
+
+static uint32_t InternName(struct SummaryNames *names, const char *name, size_t length)
+{
+	if (2 * (names->count + 1) > names->numSlots) {
+		RehashNames(names);
+	}
+
+	size_t mask = names->numSlots - 1;
+	for (size_t i = NameHash(name, length) & mask;; i = (i + 1) & mask) {
+		uint32_t slot = names->slots[i];
+		if (!slot) {
+			names->chars = Grow(names->chars, &names->capacity, names->size + length + 1, 1,
+					SUMMARY_MIN_NAMES);
+			names->offsets = Grow(names->offsets, &names->maxCount, names->count + 1,
+					sizeof(names->offsets[0]), SUMMARY_MIN_GROUPS);
+			memcpy(names->chars + names->size, name, length);
+			names->chars[names->size + length] = 0;
+			names->offsets[names->count] = names->size;
+			names->size += length + 1;
+			names->slots[i] = ++names->count;
+			return names->count - 1;
+		}
+		const char *other = NameGet(names, slot - 1);
+		if (!memcmp(other, name, length) && !other[length]) {
+			return slot - 1;
+		}
+	}
+}
+
+static void NamesInit(struct SummaryNames *names)
+{
+	memset(names, 0, sizeof(*names));
+	/* Number 0 is the empty name, e.g. of hits outside any function */
+	InternName(names, "", 0);
+}
+
+static void NamesFree(struct SummaryNames *names)
+{
+	free(names->chars);
+	free(names->offsets);
+	free(names->slots);
+	memset(names, 0, sizeof(*names));
+}
+
+void SummaryInit(struct Summary *summary)
+{
+	memset(summary, 0, sizeof(*summary));
+	NamesInit(&summary->names);
+}
+
+void SummaryFree(struct Summary *summary)
+{
+	free(summary->hits);
+	free(summary->groups);
+	free(summary->groupSlots);
+	NamesFree(&summary->names);
+	free(summary->function);
+	memset(summary, 0, sizeof(*summary));
+}
+
+/******************************************************************************
+ * Function names
+ *****************************************************************************/
+
+void SummaryEnterFunction(struct Summary *summary, const char *name, size_t length)
+{
+	summary->functionName = 0;
+	summary->functionLength = 0;
+	if (!name) {
+		return;
+	}
+	/* Copied, as name may point into a buffer that is about to be refilled */
+	summary->function = Grow(summary->function, &summary->functionCapacity, length + 1, 1,
+			SUMMARY_MIN_NAMES);
+	memcpy(summary->function, name, length);
+	summary->function[length] = 0;
+	summary->functionLength = length;
+}
+
+/******************************************************************************
+ * Hits
+ *****************************************************************************/
+
+static inline uint32_t GroupHash(uint32_t key, uint32_t function)
+{
+	uint32_t hash = (key ^ (function * 0x85ebca6bu)) * 0x9e3779b1u;
+	return hash ^ (hash >> 16);
+}
+
+static void RehashGroups(struct Summary *summary)
+{
+	size_t numSlots = summary->numGroupSlots ? (2 * summary->numGroupSlots) : SUMMARY_MIN_SLOTS;
+	uint32_t *slots = calloc(numSlots, sizeof(*slots));
+
+	if (!slots) {
+		perror("calloc");
+		exit(1);
+	}
+	for (size_t i = 0; i < summary->numGroups; i++) {
+		const struct SummaryGroup *group = &summary->groups[i];
+		size_t j = GroupHash(group->key, group->function) & (numSlots - 1);
+		while (slots[j]) {
+			j = (j + 1) & (numSlots - 1);
+		}
+		slots[j] = i + 1;
+	}
+	free(summary->groupSlots);
+	summary->groupSlots = slots;
+	summary->numGroupSlots = numSlots;
+}
+
+static uint32_t FindGroup(struct Summary *summary, uint32_t key, uint32_t function)
+{
+	if (2 * (summary->numGroups + 1) > summary->numGroupSlots) {
+		RehashGroups(summary);
+	}
+
+	size_t mask = summary->numGroupSlots - 1;
+	for (size_t i = GroupHash(key, function) & mask;; i = (i + 1) & mask) {
+		uint32_t slot = summary->groupSlots[i];
+		if (!slot) {
+			summary->groups = Grow(summary->groups, &summary->maxGroups,
+					summary->numGroups + 1, sizeof(summary->groups[0]), SUMMARY_MIN_GROUPS);
+			summary->groups[summary->numGroups] = (struct SummaryGroup) {
+				.key = key,
+				.function = function,
+			};
+			summary->groupSlots[i] = ++summary->numGroups;
+			return summary->numGroups - 1;
+		}
+		const struct SummaryGroup *group = &summary->groups[slot - 1];
+		if ((group->key == key) && (group->function == function)) {
+			return slot - 1;
+		}
+	}
+}
+
+void SummaryAdd(struct Summary *summary, uint32_t addr, uint32_t opcode)
+{
+	if (summary->functionLength && !summary->functionName) {
+		summary->functionName = InternName(&summary->names, summary->function,
+				summary->functionLength);
+	}
+
+	uint32_t group = FindGroup(summary, CoproAccessKey(opcode), summary->functionName);
+	summary->groups[group].count++;
+	summary->hits = Grow(summary->hits, &summary->maxHits, summary->numHits + 1,
+			sizeof(summary->hits[0]), SUMMARY_MIN_HITS);
+	summary->hits[summary->numHits++] = (struct SummaryHit) {
+		.group = group,
+		.addr = addr,
+		.opcode = opcode,
+	};
+}
+
+/******************************************************************************
+ * CSV output
+ *****************************************************************************/
+
+static int CompareSortKeys(const void *a, const void *b)
+{
+	uint64_t x = *(const uint64_t *)a;
+	uint64_t y = *(const uint64_t *)b;
+	return (x > y) - (x < y);
+}
+
+/**
+ * The groups are ordered by coprocessor, CRn, Op1, CRm and Op2 as in the
+ * reference manuals, the 64-bit registers of a coprocessor by Op1 and CRm
+ * after the others, writes before reads, then in the order they were
+ * first seen. The group index makes up the low half of the key.
+ */
+static inline uint64_t GroupSortKey(const struct SummaryGroup *group, uint32_t index)
+{
+	uint32_t key = group->key;
+	uint32_t order = (Extract(Cp, key) << 21) | (Extract(CRm, key) << 8) | Extract(Ldop, key);
+
+	if (Extract(Narrow, key)) {
+		order |= (Extract(CRn, key) << 16) | (Extract(Op1, key) << 12)
+			| (Extract(Op2, key) << 4);
+	}
+	else {
+		order |= (1u << 20) | (Extract(Op1Wide, key) << 12);
+	}
+	return ((uint64_t)order << 32) | index;
+}
+
+/**
+ * Write a CSV field, quoted if it needs to be.
+ */
+static char *FormatCsvField(char *p, const char *s)
+{
+	if (!strpbrk(s, ",\"\n")) {
+		return FormatString(p, s);
+	}
+	*p++ = '"';
+	for (; *s; s++) {
+		if (*s == '"') {
+			*p++ = '"';
+		}
+		*p++ = *s;
+	}
+	*p++ = '"';
+	return p;
+}
+
+static void WriteGroup(struct Output *out, const struct Summary *summary,
+		const struct SummaryGroup *group, const uint32_t *addrs, uint32_t isa)
+{
+	const char *function = NameGet(&summary->names, group->function);
+	struct ArmCoproInsn insn;
+
+	ArmCoproDecode(group->key, isa, &insn);
+
+	/*
+	 * "REGISTER[/REGISTER],ACCESS,CP,CRN,OP1,CRM,OP2,FUNCTION,COUNT,",
+	 * CRN and OP2 empty for MCRR/MRRC
+	 */
+	char *p = OutputReserve(out, 64 + ARMCOPRO_FORMAT_MAX + 2 * strlen(function) + 2);
+	for (size_t i = 0; i < insn.numRegs; i++) {
+		p = FormatString(p, i ? "/" : "");
+		p = FormatString(p, insn.regs[i].name ? insn.regs[i].name : "Unknown");
+	}
+	if (insn.wide) {
+		p = FormatString(p, insn.mrc ? ",MRRC," : ",MCRR,");
+	}
+	else {
+		p = FormatString(p, insn.mrc ? ",MRC," : ",MCR,");
+	}
+	p = FormatUnsigned(p, insn.cp);
+	p = FormatString(p, ",");
+	if (!insn.wide) {
+		p = FormatUnsigned(p, insn.crn);
+	}
+	p = FormatString(p, ",");
+	p = FormatUnsigned(p, insn.op1);
+	p = FormatString(p, ",");
+	p = FormatUnsigned(p, insn.crm);
+	p = FormatString(p, ",");
+	if (!insn.wide) {
+		p = FormatUnsigned(p, insn.op2);
+	}
+	p = FormatString(p, ",");
+	p = FormatCsvField(p, function);
+	p = FormatString(p, ",");
+	p = FormatUnsigned(p, group->count);
+	p = FormatString(p, ",");
+	OutputCommit(out, p);
+
+	/* "ADDRESS ADDRESS ...\n" */
+	for (size_t i = 0; i < group->count; i += SUMMARY_ADDRESS_BATCH) {
+		size_t end = (group->count - i < SUMMARY_ADDRESS_BATCH) ? group->count
+			: (i + SUMMARY_ADDRESS_BATCH);
+		p = OutputReserve(out, SUMMARY_ADDRESS_BATCH * sizeof("01234567 "));
+		for (size_t j = i; j < end; j++) {
+			p = FormatString(p, j ? " " : "");
+			p = FormatHex32(p, addrs[j]);
+		}
+		OutputCommit(out, p);
+	}
+	OutputCopy(out, "\n", 1);
+}
+
+void SummaryWrite(const struct Summary *summary, struct Output *out, uint32_t isa)
+{
+	static const char header[] = "register,access,cp,crn,op1,crm,op2,function,count,addresses\n";
+	uint64_t *order = ReallocOrDie(NULL, (summary->numGroups + 1) * sizeof(*order));
+	size_t *next = ReallocOrDie(NULL, (summary->numGroups + 1) * sizeof(*next));
+	uint32_t *addrs = ReallocOrDie(NULL, (summary->numHits + 1) * sizeof(*addrs));
+
+	OutputCopy(out, header, sizeof(header) - 1);
+
+	for (size_t i = 0; i < summary->numGroups; i++) {
+		order[i] = GroupSortKey(&summary->groups[i], i);
+	}
+	qsort(order, summary->numGroups, sizeof(*order), CompareSortKeys);
+
+	/* Sort the addresses by group, each group in the order of the input */
+	size_t start = 0;
+	for (size_t i = 0; i < summary->numGroups; i++) {
+		uint32_t group = (uint32_t)order[i];
+		next[group] = start;
+		start += summary->groups[group].count;
+	}
+	for (size_t i = 0; i < summary->numHits; i++) {
+		addrs[next[summary->hits[i].group]++] = summary->hits[i].addr;
+	}
+
+	/* Each next[] now points at the end of its group */
+	for (size_t i = 0; i < summary->numGroups; i++) {
+		const struct SummaryGroup *group = &summary->groups[(uint32_t)order[i]];
+		WriteGroup(out, summary, group, addrs + next[(uint32_t)order[i]] - group->count, isa);
+	}
+
+	free(order);
+	free(next);
+	free(addrs);
+}
+
+/******************************************************************************
+ * Columnar output
+ *****************************************************************************/
+
+static const char ColumnsMagic[8] = "ARMCOCOL";
+
+static const uint8_t ColumnSizes[SummaryColumns] = {
+	[ColumnAddress] = sizeof(uint32_t),
+	[ColumnOpcode] = sizeof(uint32_t),
+	[ColumnRegister] = sizeof(uint32_t),
+	[ColumnFunction] = sizeof(uint32_t),
+	[ColumnCp] = 1, [ColumnOp1] = 1, [ColumnCrn] = 1, [ColumnCrm] = 1, [ColumnOp2] = 1,
+	[ColumnRd] = 1, [ColumnRd2] = 1, [ColumnDirection] = 1, [ColumnWide] = 1,
+};
+
+static inline uint64_t AlignColumn(uint64_t offset)
+{
+	return (offset + SUMMARY_COLUMNS_ALIGN - 1) & ~(uint64_t)(SUMMARY_COLUMNS_ALIGN - 1);
+}
+
+/**
+ * Number the strings of the file: the function names keep their numbers
+ * and the register names of each group follow. Returns the register
+ * string of each group.
+ */
+static uint32_t *NameColumnStrings(const struct Summary *summary, struct SummaryNames *strings,
+		uint32_t isa)
+{
+	uint32_t *registers = ReallocOrDie(NULL, (summary->numGroups + 1) * sizeof(*registers));
+	char name[ARMCOPRO_FORMAT_MAX];
+
+	NamesInit(strings);
+	for (size_t i = 1; i < summary->names.count; i++) {
+		const char *function = NameGet(&summary->names, i);
+		InternName(strings, function, strlen(function));
+	}
+	for (size_t i = 0; i < summary->numGroups; i++) {
+		struct ArmCoproInsn insn;
+		char *p = name;
+
+		ArmCoproDecode(summary->groups[i].key, isa, &insn);
+		for (size_t j = 0; j < insn.numRegs; j++) {
+			p = FormatString(p, j ? "/" : "");
+			p = FormatString(p, insn.regs[j].name ? insn.regs[j].name : "Unknown");
+		}
+		registers[i] = InternName(strings, name, p - name);
+	}
+	return registers;
+}
+
+/**
+ * Split the hits into one array per column, in a single buffer laid out
+ * as the columns are in the file.
+ */
+static uint8_t *FillColumns(const struct Summary *summary, const uint32_t *registers,
+		const struct SummaryColumnsHeader *header)
+{
+	uint64_t base = header->columns[0];
+	uint64_t size = header->columns[SummaryColumns - 1]
+		+ summary->numHits * ColumnSizes[SummaryColumns - 1] - base;
+	uint8_t *data = calloc(1, size + 1);
+	uint32_t *words[ColumnFunction + 1];
+	uint8_t *bytes[SummaryColumns];
+
+	if (!data) {
+		perror("calloc");
+		exit(1);
+	}
+	for (size_t i = 0; i < SummaryColumns; i++) {
+		bytes[i] = data + (header->columns[i] - base);
+	}
+	for (size_t i = 0; i <= ColumnFunction; i++) {
+		words[i] = (uint32_t *)bytes[i];
+	}
+
+	for (size_t i = 0; i < summary->numHits; i++) {
+		const struct SummaryHit *hit = &summary->hits[i];
+		uint32_t opcode = hit->opcode;
+		bool wide = !Extract(Narrow, opcode);
+
+		words[ColumnAddress][i] = hit->addr;
+		words[ColumnOpcode][i] = opcode;
+		words[ColumnRegister][i] = registers[hit->group];
+		words[ColumnFunction][i] = summary->groups[hit->group].function;
+		bytes[ColumnCp][i] = Extract(Cp, opcode);
+		bytes[ColumnOp1][i] = wide ? Extract(Op1Wide, opcode) : Extract(Op1, opcode);
+		bytes[ColumnCrn][i] = wide ? 0 : Extract(CRn, opcode);
+		bytes[ColumnCrm][i] = Extract(CRm, opcode);
+		bytes[ColumnOp2][i] = wide ? 0 : Extract(Op2, opcode);
+		bytes[ColumnRd][i] = Extract(Rd, opcode);
+		bytes[ColumnRd2][i] = wide ? Extract(Rd2, opcode) : 0;
+		bytes[ColumnDirection][i] = Extract(Ldop, opcode);
+		bytes[ColumnWide][i] = wide;
+	}
+	return data;
+}
+
+/**
+ * Zero-pad from offset up to the start of the next section.
+ */
+static void WritePadding(struct Output *out, uint64_t offset, uint64_t to)
+{
+	static const char zeroes[SUMMARY_COLUMNS_ALIGN];
+
+	if (to > offset) {
+		OutputCopy(out, zeroes, to - offset);
+	}
+}
+
+void SummaryWriteColumns(const struct Summary *summary, struct Output *out, uint32_t isa)
+{
+	struct SummaryNames strings;
+	uint32_t *registers = NameColumnStrings(summary, &strings, isa);
+	struct SummaryColumnsHeader header;
+
+	memset(&header, 0, sizeof(header));
+	memcpy(header.magic, ColumnsMagic, sizeof(header.magic));
+	header.version = SUMMARY_COLUMNS_VERSION;
+	header.numColumns = SummaryColumns;
+	header.numRecords = summary->numHits;
+	header.numStrings = strings.count;
+	header.strings = AlignColumn(sizeof(header));
+	header.stringsSize = strings.count * sizeof(strings.offsets[0]) + strings.size;
+	uint64_t offset = header.strings + header.stringsSize;
+	for (size_t i = 0; i < SummaryColumns; i++) {
+		header.columns[i] = AlignColumn(offset);
+		offset = header.columns[i] + summary->numHits * ColumnSizes[i];
+	}
+
+	/* The columns are padded in the buffer already */
+	uint8_t *columns = FillColumns(summary, registers, &header);
+	OutputCopy(out, (const char *)&header, sizeof(header));
+	WritePadding(out, sizeof(header), header.strings);
+	OutputSpan(out, (const char *)strings.offsets, strings.count * sizeof(strings.offsets[0]));
+	OutputSpan(out, strings.chars, strings.size);
+	WritePadding(out, header.strings + header.stringsSize, header.columns[0]);
+	OutputSpan(out, (const char *)columns, offset - header.columns[0]);
+	OutputFlush(out);
+
+	free(columns);
+	free(registers);
+	NamesFree(&strings);
+}
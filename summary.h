@@ -0,0 +1,161 @@
+#ifndef SUMMARY_H
+#define SUMMARY_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "output.h"
+
+/******************************************************************************
+ * Summary of coprocessor accesses
+ *****************************************************************************/
+
+/*
+ * Instead of annotating every instruction, a summary groups the
+ * coprocessor accesses of a listing or an image by encoding (without the
+ * core registers), access direction and containing function, and lists where each group occurs.
+ * The hits are appended to one array and only sorted into their groups
+ * when the summary is written, so memory grows with the number of hits
+ * and not with the size of the input. Function names are only kept once
+ * a hit has been seen in the function.
+ */
+struct SummaryHit {
+	uint32_t group;
+	uint32_t addr;
+	uint32_t opcode;
+};
+
+struct SummaryGroup {
+	/* The opcode without the condition and Rd */
+	uint32_t key;
+	/* Number of the function name in names, 0 if not in a function */
+	uint32_t function;
+	uint32_t count;
+};
+
+/*
+ * Interned strings, each NUL-terminated and numbered in the order they
+ * were added. Number 0 is the empty string.
+ */
+struct SummaryNames {
+	char *chars;
+	size_t size;
+	size_t capacity;
+	/* Offset of each string in chars */
+	uint32_t *offsets;
+	size_t count;
+	size_t maxCount;
+	/* Open addressing, string number + 1 in each used slot */
+	uint32_t *slots;
+	size_t numSlots;
+};
+
+struct Summary {
+	struct SummaryHit *hits;
+	size_t numHits;
+	size_t maxHits;
+	struct SummaryGroup *groups;
+	size_t numGroups;
+	size_t maxGroups;
+	/* Open addressing, group index + 1 in each used slot */
+	uint32_t *groupSlots;
+	size_t numGroupSlots;
+	/* Function names */
+	struct SummaryNames names;
+	/* The function the next hits are in, interned on its first hit */
+	char *function;
+	size_t functionLength;
+	size_t functionCapacity;
+	uint32_t functionName;
+};
+
+void SummaryInit(struct Summary *summary);
+void SummaryFree(struct Summary *summary);
+
+/**
+ * Attribute the hits that follow to the function name[0..length), or to
+ * no function if name is NULL.
+ */
+void SummaryEnterFunction(struct Summary *summary, const char *name, size_t length);
+
+/**
+ * Count the coprocessor access opcode at addr.
+ */
+void SummaryAdd(struct Summary *summary, uint32_t addr, uint32_t opcode);
+
+/**
+ * Write the summary as CSV, one line per group, naming the registers of
+ * the ISA revisions in isa.
+ */
+void SummaryWrite(const struct Summary *summary, struct Output *out, uint32_t isa);
+
+/******************************************************************************
+ * Columnar output
+ *****************************************************************************/
+
+/*
+ * With --columnar the hits are written one record per access, in the
+ * order of the input, as a binary file that can be mapped and used in
+ * place. All fields are in host byte order; a reader on the other byte
+ * order sees the version swapped. The file starts with a
+ * struct SummaryColumnsHeader and each section starts at a multiple of
+ * SUMMARY_COLUMNS_ALIGN bytes from the start of the file, zero-padded:
+ *
+ *   strings:  uint32_t offset[numStrings], each into the text that
+ *             follows, then the NUL-terminated text of the strings.
+ *             String 0 is empty.
+ *   columns:  numRecords elements each, at columns[SummaryColumn]:
+ *             uint32_t address, opcode, register, function
+ *             uint8_t  cp, op1, crn, crm, op2, rd, rd2, direction, wide
+ *
+ * register and function are string numbers: the names of the registers
+ * the encoding accesses for the selected ISA revisions, "NAME/NAME" if
+ * there are several, and the containing function. Both are 0 if there
+ * is none. direction is 1 for reads (MRC, MRRC) and 0 for writes; wide
+ * is 1 for MCRR/MRRC, which have crn and op2 0 and a second core
+ * register in rd2.
+ */
+enum {
+	SUMMARY_COLUMNS_VERSION = 1,
+	SUMMARY_COLUMNS_ALIGN = 64,
+};
+
+enum SummaryColumn {
+	ColumnAddress,
+	ColumnOpcode,
+	ColumnRegister,
+	ColumnFunction,
+	ColumnCp,
+	ColumnOp1,
+	ColumnCrn,
+	ColumnCrm,
+	ColumnOp2,
+	ColumnRd,
+	ColumnRd2,
+	ColumnDirection,
+	ColumnWide,
+	SummaryColumns
+};
+
+struct SummaryColumnsHeader {
+	/* "ARMCOCOL" */
+	char magic[8];
+	uint32_t version;
+	uint32_t numColumns;
+	uint64_t numRecords;
+	uint64_t numStrings;
+	/* Offset and size of the string section */
+	uint64_t strings;
+	uint64_t stringsSize;
+	/* Offset of each column */
+	uint64_t columns[SummaryColumns];
+};
+
+/**
+ * Write the hits of the summary as a columnar file, naming the registers
+ * of the ISA revisions in isa. out is flushed, as the columns are only
+ * kept until it has been written.
+ */
+void SummaryWriteColumns(const struct Summary *summary, struct Output *out, uint32_t isa);
+
+#endif /* SUMMARY_H */